@@ -1,294 +1,4405 @@
 ﻿#include "multiDatabase.h"
 
+// Qt lib import
+#include <QtConcurrent>
+
+// Sqlite lib import
+#ifdef MULTIDATABASE_SQLITE_INTERRUPT
+#   include <sqlite3.h>
+#endif
+
 using namespace multi_database_space;
 
-// DatabaseSettings
-DatabaseSettings::DatabaseSettings(const DatabaseModeEnum &databastMode, const QString &databaseType, const QString &connectionName)
+// ConnectRegistry
+namespace multi_database_space
 {
-    m_databaseMode = databastMode;
-    m_databaseType = databaseType;
-    m_connectionName = connectionName;
+
+/*!
+ * \brief The ConnectRegistry class
+ * QueryMultiMode下Control持有的所有线程连接点
+ */
+class ConnectRegistry
+{
+public:
+    QMutex mutex;
+    QList<QSharedPointer<ConnectNode>> node;
+    QList<QSharedPointer<ConnectNode>> spare; // 预热的备用连接点，同时在node中，由线程首次查询时接管
+
+    void remove(const QSharedPointer<ConnectNode> &target)
+    {
+        mutex.lock();
+        node.removeOne(target);
+        mutex.unlock();
+    }
+};
+
+/*!
+ * \brief The GroupCommitQueue class
+ * Control::enqueue()使用的组提交写队列。生产者线程入队后立即返回QFuture，单个写线程每groupCommitInterval
+ * 或攒满groupCommitBatchSize条语句时，借出一个写连接，在一个事务中依次执行并提交。
+ * 语句失败时回滚，将失败的语句单独返回错误，其余语句重新执行并提交，使同批语句互不影响。
+ * 未能借出写连接或无法开始事务时整批失败，不在事务外逐条执行。
+ */
+class GroupCommitQueue: public QThread
+{
+private:
+    struct Entry
+    {
+        QString sql;
+        QVariantList binds;
+        QFutureInterface<ResultSet> future;
+    };
+
+    Control *m_control;
+    const int m_interval;
+    const int m_batchSize;
+    const int m_maxPending;
+    const bool m_durable;
+
+    QMutex m_mutex;
+    QWaitCondition m_condition; // 唤醒写线程
+    QWaitCondition m_space; // 唤醒等待队列空间的生产者
+    QList<Entry> m_pending;
+    bool m_stop = false;
+
+    QAtomicInteger<qint64> m_flushCount;
+    QAtomicInteger<qint64> m_statementCount;
+    QAtomicInteger<qint64> m_errorCount;
+    QAtomicInteger<qint64> m_rollbackCount;
+    QAtomicInteger<qint64> m_droppedCount;
+    QSqlError m_lastError; // 由m_mutex保护
+    QString m_lastErrorFingerprint;
+
+public:
+    GroupCommitQueue(Control *control, const ConnectSettings &connectSettings):
+        m_control(control),
+        m_interval(qMax(0, connectSettings.groupCommitInterval())),
+        m_batchSize(qMax(1, connectSettings.groupCommitBatchSize())),
+        m_maxPending(qMax(0, connectSettings.groupCommitMaxPending())),
+        m_durable(connectSettings.groupCommitDurable())
+    { }
+
+    /*!
+     * \brief ~GroupCommitQueue 提交队列中剩余的语句后结束写线程
+     */
+    ~GroupCommitQueue(void)
+    {
+        m_mutex.lock();
+        m_stop = true;
+        m_condition.wakeAll();
+        m_space.wakeAll();
+        m_mutex.unlock();
+
+        wait();
+    }
+
+    QFuture<ResultSet> enqueue(const QString &sql, const QVariantList &binds)
+    {
+        QFutureInterface<ResultSet> future;
+        future.reportStarted();
+
+        m_mutex.lock();
+
+        while(!m_stop && m_maxPending && (m_pending.size() >= m_maxPending))
+        {
+            m_space.wait(&m_mutex);
+        }
+
+        if(m_stop)
+        {
+            m_mutex.unlock();
+
+            ResultSet result;
+            result.error = QSqlError("GroupCommitQueue::enqueue", "queue stopped", QSqlError::ConnectionError);
+            future.reportFinished(&result);
+            return future.future();
+        }
+
+        m_pending.append({ sql, binds, future });
+        if(!isRunning()) {
+            start();
+        }
+
+        // 队列由空变为非空时开始计时，攒满时立即提交
+        if((m_pending.size() == 1) || (m_pending.size() >= m_batchSize)) {
+            m_condition.wakeAll();
+        }
+
+        m_mutex.unlock();
+
+        if(!m_durable)
+        {
+            ResultSet result;
+            result.ok = true;
+            future.reportFinished(&result);
+        }
+
+        return future.future();
+    }
+
+    GroupCommitStats stats(void)
+    {
+        GroupCommitStats stats;
+        stats.flushCount = m_flushCount.load();
+        stats.statementCount = m_statementCount.load();
+        stats.errorCount = m_errorCount.load();
+        stats.rollbackCount = m_rollbackCount.load();
+        stats.droppedCount = m_droppedCount.load();
+
+        m_mutex.lock();
+        stats.pendingSize = m_pending.size();
+        stats.lastError = m_lastError;
+        stats.lastErrorFingerprint = m_lastErrorFingerprint;
+        m_mutex.unlock();
+
+        return stats;
+    }
+
+protected:
+    void run(void) override
+    {
+        m_mutex.lock();
+
+        forever
+        {
+            while(m_pending.isEmpty() && !m_stop)
+            {
+                m_condition.wait(&m_mutex);
+            }
+            if(m_pending.isEmpty()) {
+                break;
+            }
+
+            if(m_interval > 0)
+            {
+                QElapsedTimer timer;
+                timer.start();
+                while(!m_stop && (m_pending.size() < m_batchSize))
+                {
+                    const auto &&remaining = m_interval - timer.elapsed();
+                    if(remaining <= 0) {
+                        break;
+                    }
+                    m_condition.wait(&m_mutex, remaining);
+                }
+            }
+
+            QList<Entry> batch;
+            if(m_pending.size() <= m_batchSize)
+            {
+                batch.swap(m_pending);
+            }
+            else
+            {
+                batch = m_pending.mid(0, m_batchSize);
+                m_pending.erase(m_pending.begin(), m_pending.begin() + m_batchSize);
+            }
+            m_space.wakeAll();
+
+            m_mutex.unlock();
+            flush(batch);
+            m_mutex.lock();
+        }
+
+        m_mutex.unlock();
+    }
+
+private:
+    void flush(QList<Entry> &batch)
+    {
+        QVector<ResultSet> result(batch.size());
+        QVector<int> pending;
+        for(int now = 0; now < batch.size(); now++)
+        {
+            pending.append(now);
+        }
+
+        {
+            auto query(m_control->writeQuery());
+
+            while(!pending.isEmpty())
+            {
+                if(!query.isValid() || !query.transaction())
+                {
+                    auto error = query.isValid() ? query.lastDatabaseError() : query->lastError();
+                    if(!error.isValid()) {
+                        error = QSqlError("GroupCommitQueue::flush", "cannot begin transaction", QSqlError::TransactionError);
+                    }
+
+                    for(const auto &index: pending)
+                    {
+                        result[index] = ResultSet();
+                        result[index].error = error;
+                    }
+                    break;
+                }
+
+                // 同一语句连续入队时只prepare一次
+                QString prepared;
+                QVector<int> failed;
+                for(const auto &index: pending)
+                {
+                    const auto &entry = batch[index];
+
+                    if(entry.sql != prepared)
+                    {
+                        prepared.clear();
+                        if(!query->prepare(entry.sql))
+                        {
+                            result[index] = query.resultSet(false);
+                            failed.append(index);
+                            continue;
+                        }
+                        prepared = entry.sql;
+                    }
+
+                    for(const auto &value: entry.binds)
+                    {
+                        query->addBindValue(value);
+                    }
+
+                    result[index] = query.resultSet(query.exec());
+                    if(!result[index].ok) {
+                        failed.append(index);
+                    }
+                }
+
+                if(failed.isEmpty())
+                {
+                    if(query.commit()) {
+                        break;
+                    }
+
+                    // 提交失败时整批失败
+                    const auto &&error = query.lastDatabaseError();
+                    query.rollback();
+                    for(const auto &index: pending)
+                    {
+                        result[index] = ResultSet();
+                        result[index].error = error;
+                    }
+                    m_rollbackCount.fetchAndAddRelaxed(1);
+                    break;
+                }
+
+                // 回滚后去掉失败的语句重新执行
+                query.rollback();
+                m_rollbackCount.fetchAndAddRelaxed(1);
+                for(const auto &index: failed)
+                {
+                    pending.removeOne(index);
+                }
+            }
+        }
+
+        m_flushCount.fetchAndAddRelaxed(1);
+        for(int now = 0; now < batch.size(); now++)
+        {
+            (result[now].ok ? m_statementCount : m_errorCount).fetchAndAddRelaxed(1);
+
+            if(!result[now].ok)
+            {
+                const auto &&fingerprint = Control::fingerprint(batch[now].sql);
+
+                m_mutex.lock();
+                m_lastError = result[now].error;
+                m_lastErrorFingerprint = fingerprint;
+                m_mutex.unlock();
+            }
+
+            if(!m_durable)
+            {
+                // 入队时已报告成功，失败的语句只能从统计中得知
+                if(!result[now].ok)
+                {
+                    m_droppedCount.fetchAndAddRelaxed(1);
+                    qWarning() << "GroupCommitQueue::flush: dropped" << batch[now].sql << result[now].error.text();
+                }
+                continue;
+            }
+
+            batch[now].future.reportFinished(&result[now]);
+        }
+    }
+};
+
+/*!
+ * \brief The SlowQueryLog class
+ * Control的慢查询日志。Query执行后调用record()，未超过阈值且未被抽样的语句只做一次比较；
+ * 记录的语句在调用线程中计算指纹并汇总，日志行由后台线程格式化并写入文件，文件超过上限时轮转。
+ * 待写入的记录超过上限时丢弃，调用线程不会等待文件IO。
+ */
+class SlowQueryLog: public QThread
+{
+private:
+    struct Entry
+    {
+        QDateTime time;
+        QString sql;
+        QString fingerprint;
+        qint64 elapsed;
+        bool ok;
+        bool slow;
+    };
+
+    static const int MaxPending = 10000;
+    static const int MaxFingerprints = 1000; // 汇总的指纹数上限
+
+    const qint64 m_threshold; // 微秒
+    const double m_sampleRate;
+    const QString m_path;
+    const qint64 m_maxSize;
+    const int m_maxFiles;
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QHash<QString, SlowQueryStats> m_stats;
+    QMultiMap<qint64, QString> m_order; // 按总耗时索引m_stats的指纹，淘汰时取最小者
+    QList<Entry> m_pending;
+    bool m_stop = false;
+
+    QFile m_file; // 只在写线程中访问
+
+public:
+    SlowQueryLog(const ConnectSettings &connectSettings):
+        m_threshold(qint64(connectSettings.slowQueryThreshold()) * 1000),
+        m_sampleRate(connectSettings.slowQuerySampleRate()),
+        m_path(connectSettings.slowQueryLogPath()),
+        m_maxSize(qMax<qint64>(1024, connectSettings.slowQueryLogMaxSize())),
+        m_maxFiles(connectSettings.slowQueryLogMaxFiles())
+    {
+        if(!m_path.isEmpty()) {
+            start(QThread::LowPriority);
+        }
+    }
+
+    ~SlowQueryLog(void)
+    {
+        m_mutex.lock();
+        m_stop = true;
+        m_condition.wakeAll();
+        m_mutex.unlock();
+
+        wait();
+    }
+
+    /*!
+     * \brief record 记录一次语句执行
+     * \param elapsed 执行时间，微秒
+     */
+    void record(const QString &sql, const qint64 &elapsed, const bool &ok)
+    {
+        const auto &&slow = elapsed >= m_threshold;
+        if(!slow && ((m_sampleRate <= 0) || (QRandomGenerator::global()->generateDouble() >= m_sampleRate))) {
+            return;
+        }
+
+        const auto &&fingerprint = Control::fingerprint(sql);
+
+        m_mutex.lock();
+
+        // 动态表名、列名等会不断产生新指纹，只保留总耗时最多的指纹以限制内存：
+        // 达到上限时新指纹的耗时须超过当前最少的总耗时才淘汰后者并加入，否则只写日志不汰换，避免新指纹相互淘汰
+        auto found = m_stats.find(fingerprint);
+        if(found == m_stats.end())
+        {
+            if(m_stats.size() >= MaxFingerprints)
+            {
+                const auto smallest = m_order.begin();
+                if(elapsed > smallest.key())
+                {
+                    m_stats.remove(smallest.value());
+                    m_order.erase(smallest);
+                }
+            }
+
+            if(m_stats.size() < MaxFingerprints)
+            {
+                found = m_stats.insert(fingerprint, SlowQueryStats());
+                found->fingerprint = fingerprint;
+            }
+        }
+        else
+        {
+            m_order.remove(found->totalTime, fingerprint);
+        }
+
+        if(found != m_stats.end())
+        {
+            auto &stats = *found;
+            stats.sample = sql;
+            stats.count++;
+            stats.slowCount += slow ? 1 : 0;
+            stats.errorCount += ok ? 0 : 1;
+            stats.totalTime += elapsed;
+            stats.maxTime = qMax(stats.maxTime, elapsed);
+            m_order.insert(stats.totalTime, fingerprint);
+        }
+
+        if(!m_path.isEmpty() && (m_pending.size() < MaxPending))
+        {
+            m_pending.append({ QDateTime::currentDateTimeUtc(), sql, fingerprint, elapsed, ok, slow });
+            m_condition.wakeOne();
+        }
+
+        m_mutex.unlock();
+    }
+
+    QList<SlowQueryStats> stats(void)
+    {
+        m_mutex.lock();
+        auto result = m_stats.values();
+        m_mutex.unlock();
+
+        std::sort(result.begin(), result.end(), [](const SlowQueryStats &a, const SlowQueryStats &b) { return a.totalTime > b.totalTime; });
+        return result;
+    }
+
+protected:
+    void run(void) override
+    {
+        m_mutex.lock();
+
+        while(!m_stop || !m_pending.isEmpty())
+        {
+            if(m_pending.isEmpty())
+            {
+                m_condition.wait(&m_mutex);
+                continue;
+            }
+
+            QList<Entry> batch;
+            batch.swap(m_pending);
+
+            m_mutex.unlock();
+            write(batch);
+            m_mutex.lock();
+        }
+
+        m_mutex.unlock();
+        m_file.close();
+    }
+
+private:
+    void write(const QList<Entry> &batch)
+    {
+        if(!m_file.isOpen() && !open()) {
+            return;
+        }
+
+        for(const auto &entry: batch)
+        {
+            m_file.write(QJsonDocument(QJsonObject({
+                                                       { "time", entry.time.toString(Qt::ISODateWithMs) },
+                                                       { "elapsed", entry.elapsed },
+                                                       { "ok", entry.ok },
+                                                       { "slow", entry.slow },
+                                                       { "fingerprint", entry.fingerprint },
+                                                       { "sql", entry.sql }
+                                                   })).toJson(QJsonDocument::Compact) + '\n');
+
+            if((m_file.size() >= m_maxSize) && !rotate()) {
+                return;
+            }
+        }
+        m_file.flush();
+    }
+
+    bool open(void)
+    {
+        m_file.setFileName(m_path);
+        if(!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+        {
+            qWarning() << "SlowQueryLog::open:" << m_path << m_file.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    /*!
+     * \brief rotate path.n-1重命名为path.n，...，path重命名为path.1，超出maxFiles的文件删除
+     */
+    bool rotate(void)
+    {
+        m_file.close();
+
+        if(m_maxFiles > 0)
+        {
+            QFile::remove(QString("%1.%2").arg(m_path).arg(m_maxFiles));
+            for(int index = m_maxFiles - 1; index >= 1; index--)
+            {
+                QFile::rename(QString("%1.%2").arg(m_path).arg(index), QString("%1.%2").arg(m_path).arg(index + 1));
+            }
+            QFile::rename(m_path, m_path + ".1");
+        }
+        else
+        {
+            QFile::remove(m_path);
+        }
+
+        return open();
+    }
+};
+
 }
 
-DatabaseSettings::DatabaseSettings(const QString &databaseType, const QString &connectionName, const QString &nameModeName):
-    DatabaseSettings(DatabaseNameMode, databaseType, connectionName)
+namespace
 {
-    m_nameModeName = nameModeName;
+
+/*!
+ * \brief The ConnectReaper class
+ * 进程内唯一的空闲连接回收线程。定期扫描已注册连接点的最后使用时间，关闭空置超过maxOpenTime的连接，
+ * 查询路径上只需原子地记录时间，不再向主线程投递计时器事件。
+ */
+class ConnectReaper: public QThread
+{
+private:
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QSet<ConnectNode *> m_node;
+    bool m_stop = false;
+
+public:
+    static ConnectReaper &instance(void)
+    {
+        static ConnectReaper reaper;
+        return reaper;
+    }
+
+    /*!
+     * \brief now 进程内单调时钟，毫秒
+     */
+    static qint64 now(void)
+    {
+        static const QElapsedTimer clock = []() { QElapsedTimer timer; timer.start(); return timer; }();
+        return clock.elapsed();
+    }
+
+    ~ConnectReaper(void)
+    {
+        m_mutex.lock();
+        m_stop = true;
+        m_condition.wakeAll();
+        m_mutex.unlock();
+
+        wait();
+    }
+
+    void insert(ConnectNode *node)
+    {
+        m_mutex.lock();
+
+        m_node.insert(node);
+        if(!isRunning()) {
+            start(QThread::LowPriority);
+        }
+        m_condition.wakeAll();
+
+        m_mutex.unlock();
+    }
+
+    /*!
+     * \brief remove 注销连接点，正在扫描时等待扫描结束，保证返回后不再访问该连接点
+     */
+    void remove(ConnectNode *node)
+    {
+        m_mutex.lock();
+        m_node.remove(node);
+        m_mutex.unlock();
+    }
+
+protected:
+    void run(void) override
+    {
+        m_mutex.lock();
+
+        while(!m_stop)
+        {
+            if(m_node.isEmpty())
+            {
+                m_condition.wait(&m_mutex);
+                continue;
+            }
+
+            // 扫描间隔为最短maxOpenTime的一半，连接最迟在空置1.5倍maxOpenTime后关闭
+            int interval = 5 * 1000;
+            const auto &&current = now();
+            for(const auto &node: m_node)
+            {
+                node->closeIfIdle(current);
+                interval = qMin(interval, node->maxOpenTime() / 2);
+            }
+
+            m_condition.wait(&m_mutex, qMax(50, interval));
+        }
+
+        m_mutex.unlock();
+    }
+};
+
+/*!
+ * \brief The DeadlineWatchdog class
+ * 进程内唯一的截止时间监视线程。有截止时间的语句执行前登记中断函数，到期时交给中断线程池调用，
+ * 语句在到期前结束时注销，查询路径上不创建计时器。
+ */
+class DeadlineWatchdog: public QThread
+{
+private:
+    struct Entry
+    {
+        QDeadlineTimer deadline;
+        std::function<void(void)> interrupt;
+    };
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QWaitCondition m_finished; // 正在调用的中断函数返回时唤醒
+    QMap<int, Entry> m_entry;
+    int m_serial = 0;
+    QSet<int> m_running; // 正在中断线程池中调用的中断函数序号
+    bool m_stop = false;
+
+    // 中断函数(如QMYSQL的KILL QUERY需另开连接)可能很慢，在独立的线程池中调用，
+    // 一个无响应的服务器不会推迟其他语句的到期中断；最后声明，最先析构，析构时等待正在调用的中断函数
+    QThreadPool m_pool;
+
+public:
+    static DeadlineWatchdog &instance(void)
+    {
+        static DeadlineWatchdog watchdog;
+        return watchdog;
+    }
+
+    ~DeadlineWatchdog(void)
+    {
+        m_mutex.lock();
+        m_stop = true;
+        m_condition.wakeAll();
+        m_mutex.unlock();
+
+        wait();
+        m_pool.waitForDone();
+    }
+
+    int insert(const QDeadlineTimer &deadline, const std::function<void(void)> &interrupt)
+    {
+        m_mutex.lock();
+
+        const auto &&id = m_serial++;
+        m_entry.insert(id, Entry{ deadline, interrupt });
+        if(!isRunning()) {
+            start();
+        }
+        m_condition.wakeAll();
+
+        m_mutex.unlock();
+        return id;
+    }
+
+    /*!
+     * \brief remove 注销中断函数，正在调用时等待其返回，保证返回后不再中断该连接上的其他语句
+     */
+    void remove(const int &id)
+    {
+        m_mutex.lock();
+        m_entry.remove(id);
+        while(m_running.contains(id))
+        {
+            m_finished.wait(&m_mutex);
+        }
+        m_mutex.unlock();
+    }
+
+protected:
+    void run(void) override
+    {
+        m_mutex.lock();
+
+        while(!m_stop)
+        {
+            qint64 interval = -1;
+            auto expired = m_entry.end();
+            for(auto it = m_entry.begin(); it != m_entry.end(); ++it)
+            {
+                const auto &&remaining = it->deadline.remainingTime();
+                if(!remaining)
+                {
+                    expired = it;
+                    break;
+                }
+
+                interval = (interval < 0) ? remaining : qMin(interval, remaining);
+            }
+
+            // 中断函数在线程池中、锁外调用，不阻塞其他语句的登记、注销与到期，
+            // remove()等待正在调用的中断函数，保证语句结束后不会被中断
+            if(expired != m_entry.end())
+            {
+                const auto &&id = expired.key();
+                const auto interrupt = expired->interrupt;
+                m_entry.erase(expired);
+
+                m_running.insert(id);
+                QtConcurrent::run(&m_pool, [this, id, interrupt]()
+                {
+                    interrupt();
+
+                    m_mutex.lock();
+                    m_running.remove(id);
+                    m_finished.wakeAll();
+                    m_mutex.unlock();
+                });
+                continue;
+            }
+
+            if(interval < 0) {
+                m_condition.wait(&m_mutex);
+            } else {
+                m_condition.wait(&m_mutex, interval);
+            }
+        }
+
+        m_mutex.unlock();
+    }
+};
+
+/*!
+ * \brief killQuery 另开连接，以KILL QUERY中断QMYSQL连接上正在执行的语句
+ * \param threadId 被中断连接在服务端的线程ID
+ */
+void killQuery(const DatabaseSettings &databaseSettings, const qint64 &threadId)
+{
+    static QAtomicInt serial;
+    const auto &&connectionName = QString("%1(kill:%2)").arg(databaseSettings.connectionName()).arg(serial.fetchAndAddRelaxed(1));
+
+    {
+        auto database = QSqlDatabase::addDatabase(databaseSettings.databaseType(), connectionName);
+        database.setConnectOptions(databaseSettings.connectOptions());
+        database.setHostName(databaseSettings.hostModeHostName());
+        database.setDatabaseName(databaseSettings.hostModeDatabaseName());
+        database.setUserName(databaseSettings.hostModeUserName());
+        database.setPassword(databaseSettings.hostModePassword());
+
+        if(database.open())
+        {
+            QSqlQuery query(database);
+            if(!query.exec(QString("KILL QUERY %1").arg(threadId))) {
+                qWarning() << "killQuery:" << query.lastError().text();
+            }
+        }
+        database.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+/*!
+ * \brief The NullResult class
+ * 无效Query的结果集，没有驱动，QSqlQuery的exec()、prepare()等直接失败。
+ * QSqlQuery以无效的QSqlDatabase构造时会改用程序的默认连接，无效Query因此不能以QSqlDatabase()构造。
+ */
+class NullResult: public QSqlResult
+{
+public:
+    NullResult(void):
+        QSqlResult(nullptr)
+    {
+        setLastError(QSqlError("Query", "no connection available", QSqlError::ConnectionError));
+    }
+
+protected:
+    QVariant data(int) override { return QVariant(); }
+
+    bool isNull(int) override { return true; }
+
+    bool reset(const QString &) override { return false; }
+
+    bool fetch(int) override { return false; }
+
+    bool fetchFirst(void) override { return false; }
+
+    bool fetchLast(void) override { return false; }
+
+    int size(void) override { return -1; }
+
+    int numRowsAffected(void) override { return -1; }
+};
+
+/*!
+ * \brief leaseThread 本线程的序号(每个线程分配一次，不为0)，位于租约标识的高32位
+ */
+quint64 leaseThread(void)
+{
+    static QAtomicInt threadSerial;
+    thread_local const quint64 thread = quint64(quint32(threadSerial.fetchAndAddRelaxed(1)) + 1) << 32;
+
+    return thread;
+}
+
+/*!
+ * \brief leaseIdentity 新租约的标识，不为0：高32位为线程序号，低32位为线程内的租约序号
+ */
+quint64 leaseIdentity(void)
+{
+    thread_local quint32 serial = 0;
+
+    return leaseThread() | ++serial;
+}
+
+/*!
+ * \brief The ThreadConnectCache class
+ * 线程本地的连接点句柄缓存，线程结束时将连接点从所属Control注销，连接点随最后一个引用销毁
+ */
+class ThreadConnectCache
+{
+public:
+    struct Entry
+    {
+        int controlId;
+        QSharedPointer<ConnectNode> node;
+        QWeakPointer<ConnectRegistry> registry;
+    };
+
+    QVector<Entry> entry;
+
+    ~ThreadConnectCache(void)
+    {
+        for(const auto &now: entry)
+        {
+            const auto &&registry = now.registry.toStrongRef();
+            if(registry) {
+                registry->remove(now.node);
+            }
+
+            // 立即关闭连接，不等待其他持有者释放连接点
+            now.node->discard();
+        }
+    }
+};
+
+thread_local ThreadConnectCache threadConnectCache;
+
+/*!
+ * \brief ketamaPoint MD5摘要中第part个4字节(小端)组成的哈希环位置
+ */
+inline quint32 ketamaPoint(const QByteArray &digest, const int &part)
+{
+    const auto data = reinterpret_cast<const uchar *>(digest.constData()) + part * 4;
+    return (quint32(data[3]) << 24) | (quint32(data[2]) << 16) | (quint32(data[1]) << 8) | quint32(data[0]);
+}
+
+/*!
+ * \brief threadAgnosticDriver 驱动的连接能否在打开它的线程之外使用(同一时刻只有一个线程)
+ * QtSql要求连接只在创建它的线程中使用，预热的连接在临时线程中打开、由其他线程接管，
+ * 只对客户端库本身线程安全的驱动(SQLite、MySQL/MariaDB、PostgreSQL)成立
+ */
+bool threadAgnosticDriver(const QString &databaseType)
+{
+    return databaseType.startsWith("QSQLITE") || databaseType.startsWith("QMYSQL") || databaseType.startsWith("QMARIADB") || databaseType.startsWith("QPSQL");
+}
+
+/*!
+ * \brief skipWarmUp 驱动不允许连接跨线程使用时跳过Control::warmUp()(仅提示一次)，连接改由首次使用的线程创建
+ */
+bool skipWarmUp(const QString &databaseType)
+{
+    if(threadAgnosticDriver(databaseType)) { return false; }
+
+    static QAtomicInt warned(0);
+    if(warned.testAndSetRelaxed(0, 1))
+    {
+        qWarning() << "Control::warmUp:" << databaseType << "connections cannot be handed over between threads, warm-up skipped";
+    }
+    return true;
+}
+
+/*!
+ * \brief openConnectNodes 创建count个连接点(构造时即打开连接)，并执行验证语句，
+ * 驱动允许连接跨线程使用时各连接在独立线程中并发打开，否则在调用线程中依次打开
+ * \param succeeded 验证通过的连接数
+ * \return 所有新建的连接点，包括验证失败的，由调用者持有
+ */
+QList<ConnectNode *> openConnectNodes(const int &count, const DatabaseSettings &databaseSettings, const ConnectSettings &connectSettings, const QSharedPointer<Throttle> &throttle, const QSharedPointer<CircuitBreaker> &breaker, const QString &statement, int *succeeded)
+{
+    const auto &&open = [&]()
+    {
+        auto node = new ConnectNode(databaseSettings, connectSettings, throttle, breaker);
+        return qMakePair(node, node->warmUp(statement));
+    };
+
+    QList<QPair<ConnectNode *, bool>> result;
+    if((count == 1) || !threadAgnosticDriver(databaseSettings.databaseType()))
+    {
+        // 只有一个连接时无需额外线程，连接不能跨线程时在调用线程中依次打开
+        for(int now = 0; now < count; now++)
+        {
+            result.append(open());
+        }
+    }
+    else if(count > 1)
+    {
+        // MySql、PostgreSql的TCP与认证握手耗时较长，各连接在独立线程中同时进行
+        QThreadPool pool;
+        pool.setMaxThreadCount(count);
+
+        QList<QFuture<QPair<ConnectNode *, bool>>> future;
+        for(int now = 0; now < count; now++)
+        {
+            future.append(QtConcurrent::run(&pool, open));
+        }
+        for(auto &now: future)
+        {
+            result.append(now.result());
+        }
+    }
+
+    QList<ConnectNode *> node;
+    for(const auto &now: result)
+    {
+        node.append(now.first);
+        if(succeeded && now.second) {
+            (*succeeded)++;
+        }
+    }
+    return node;
+}
+
+/*!
+ * \brief The DelimitedReader class
+ * Control::bulkLoad()使用的CSV/TSV解析器，直接在内存映射的文件上逐条读取记录，字段只记录位置，不复制。
+ */
+class DelimitedReader
+{
+public:
+    struct Field
+    {
+        const char *data;
+        int size;
+        bool quoted;
+        bool escaped; // 引号内含有连续两个引号，取值时须去掉其中一个
+    };
+
+private:
+    const char *m_begin;
+    const char *m_position;
+    const char *m_end;
+    const char m_delimiter;
+    const char m_quote;
+
+public:
+    DelimitedReader(const char *data, const qint64 &size, const char &delimiter, const char &quote):
+        m_begin(data),
+        m_position(data),
+        m_end(data + size),
+        m_delimiter(delimiter),
+        m_quote(quote)
+    { }
+
+    inline qint64 offset(void) const { return m_position - m_begin; }
+
+    /*!
+     * \brief readRow 读取下一条记录的所有字段，跳过空行
+     * \return 已读完时返回false
+     */
+    bool readRow(QVarLengthArray<Field, 16> &fields)
+    {
+        forever
+        {
+            fields.clear();
+            if(m_position >= m_end) {
+                return false;
+            }
+
+            readFields(fields);
+
+            if((fields.size() > 1) || fields[0].size || fields[0].quoted) {
+                return true;
+            }
+        }
+    }
+
+    /*!
+     * \brief value 字段的绑定值：\\N为NULL，未加引号的整数为qint64，其余为QString
+     */
+    QVariant value(const Field &field) const
+    {
+        if(!field.quoted)
+        {
+            if((field.size == 2) && (field.data[0] == '\\') && (field.data[1] == 'N')) {
+                return QVariant(QVariant::String);
+            }
+
+            qint64 integer;
+            if(parseInteger(field.data, field.size, integer)) {
+                return integer;
+            }
+        }
+
+        if(!field.escaped) {
+            return QString::fromUtf8(field.data, field.size);
+        }
+
+        QByteArray buffer;
+        buffer.reserve(field.size);
+        for(int index = 0; index < field.size; index++)
+        {
+            buffer.append(field.data[index]);
+            if(field.data[index] == m_quote) {
+                index++;
+            }
+        }
+        return QString::fromUtf8(buffer);
+    }
+
+private:
+    void readFields(QVarLengthArray<Field, 16> &fields)
+    {
+        forever
+        {
+            Field field = { m_position, 0, false, false };
+
+            if(m_quote && (m_position < m_end) && (*m_position == m_quote))
+            {
+                field.data = ++m_position;
+                field.quoted = true;
+
+                // 引号未闭合时取到文件末尾
+                auto closing = m_end;
+                forever
+                {
+                    const auto quote = static_cast<const char *>(memchr(m_position, m_quote, size_t(m_end - m_position)));
+                    if(!quote)
+                    {
+                        m_position = m_end;
+                        break;
+                    }
+
+                    if((quote + 1 < m_end) && (quote[1] == m_quote))
+                    {
+                        field.escaped = true;
+                        m_position = quote + 2;
+                        continue;
+                    }
+
+                    closing = quote;
+                    m_position = quote + 1;
+                    break;
+                }
+                field.size = int(closing - field.data);
+            }
+
+            while((m_position < m_end) && (*m_position != m_delimiter) && (*m_position != '\n') && (*m_position != '\r'))
+            {
+                m_position++;
+            }
+            if(!field.quoted) {
+                field.size = int(m_position - field.data);
+            }
+
+            fields.append(field);
+
+            if((m_position < m_end) && (*m_position == m_delimiter))
+            {
+                m_position++;
+                continue;
+            }
+
+            if((m_position < m_end) && (*m_position == '\r')) {
+                m_position++;
+            }
+            if((m_position < m_end) && (*m_position == '\n')) {
+                m_position++;
+            }
+            return;
+        }
+    }
+
+    static bool parseInteger(const char *data, const int &size, qint64 &value)
+    {
+        int index = 0;
+        if(size && ((data[0] == '-') || (data[0] == '+'))) {
+            index = 1;
+        }
+
+        // 保留前导0的编号(如"007")与超出qint64的数字按文本绑定
+        const auto &&digits = size - index;
+        if((digits < 1) || (digits > 18) || ((digits > 1) && (data[index] == '0'))) {
+            return false;
+        }
+
+        qint64 result = 0;
+        for(; index < size; index++)
+        {
+            const auto &&digit = data[index] - '0';
+            if((digit < 0) || (digit > 9)) {
+                return false;
+            }
+            result = result * 10 + digit;
+        }
+
+        value = (data[0] == '-') ? -result : result;
+        return true;
+    }
+};
+
+/*!
+ * \brief multiRowInsert 插入rows行的多行insert语句
+ */
+QString multiRowInsert(const QString &table, const QStringList &columns, const int &rows)
+{
+    const auto &&row = QString("(?%1), ").arg(QString(", ?").repeated(columns.size() - 1));
+
+    auto values = row.repeated(rows);
+    values.chop(2);
+
+    return QString("insert into %1(%2) values %3").arg(table, columns.join(", "), values);
+}
+
+/*!
+ * \brief loadDataStatement QMYSQL的LOAD DATA LOCAL INFILE语句
+ * \param crlf 文件是否以\r\n换行
+ */
+QString loadDataStatement(const QString &path, const BulkLoadSettings &settings, const bool &crlf)
+{
+    const auto &&escape = [](QString text) { return text.replace("\\", "\\\\").replace("'", "\\'"); };
+
+    auto sql = QString("LOAD DATA LOCAL INFILE '%1' INTO TABLE %2 CHARACTER SET utf8mb4 FIELDS TERMINATED BY '%3'")
+            .arg(escape(QFileInfo(path).absoluteFilePath()), settings.table(), escape(QString(QChar(settings.delimiter()))));
+    if(settings.quote()) {
+        sql += QString(" OPTIONALLY ENCLOSED BY '%1'").arg(escape(QString(QChar(settings.quote()))));
+    }
+    sql += crlf ? " LINES TERMINATED BY '\\r\\n'" : " LINES TERMINATED BY '\\n'";
+    if(settings.skipHeader()) {
+        sql += " IGNORE 1 LINES";
+    }
+    sql += QString(" (%1)").arg(settings.columns().join(", "));
+
+    return sql;
+}
+
+}
+
+// DatabaseSettings
+DatabaseSettings::DatabaseSettings(const DatabaseModeEnum &databastMode, const QString &databaseType, const QString &connectionName)
+{
+    m_databaseMode = databastMode;
+    m_databaseType = databaseType;
+    m_connectionName = connectionName;
+}
+
+DatabaseSettings::DatabaseSettings(const QString &databaseType, const QString &connectionName, const QString &nameModeName):
+    DatabaseSettings(DatabaseNameMode, databaseType, connectionName)
+{
+    m_nameModeName = nameModeName;
+}
+
+DatabaseSettings::DatabaseSettings(const QString &databaseType, const QString &connectionName, const QString &hostModeHostName, const QString &hostModeDatabaseName, const QString &hostModeUserName, const QString &hostModePassword):
+    DatabaseSettings(DatabaseHostMode, databaseType, connectionName)
+{
+    m_hostModeHostName = hostModeHostName;
+    m_hostModeDatabaseName = hostModeDatabaseName;
+    m_hostModeUserName = hostModeUserName;
+    m_hostModePassword = hostModePassword;
+}
+
+// ConnectSettings
+ConnectSettings::ConnectSettings(const int &maxOpenTime, const QueryMode &queryMode, const int &minWaitTime)
+{
+    m_maxOpenTime = maxOpenTime;
+    m_queryMode = queryMode;
+    m_minWaitTime = minWaitTime;
+
+    m_rateLimit = 0;
+    m_rateBurst = 1;
+    m_busyRetryCount = 5;
+    m_busyBackoffTime = 2;
+    m_busyBackoffMaxTime = 200;
+
+    m_poolMinSize = 1;
+    m_poolMaxSize = 8;
+    m_poolWaitTime = 30 * 1000;
+
+    m_walReaderCount = QThread::idealThreadCount();
+
+    m_statementCacheSize = 32;
+
+    m_batchChunkSize = 1000;
+
+    m_asyncThreadCount = 0;
+
+    m_enableMetrics = true;
+
+    m_warmUpCount = 0;
+    m_warmUpInBackground = false;
+
+    m_healthCheckIdleTime = 30 * 1000;
+    m_reconnectRetryCount = 2;
+    m_reconnectBackoffTime = 100;
+    m_reconnectBackoffMaxTime = 10 * 1000;
+    m_breakerThreshold = 3;
+
+    m_cursorChunkSize = 1000;
+
+    m_groupCommitInterval = 5;
+    m_groupCommitBatchSize = 1000;
+    m_groupCommitMaxPending = 100000;
+    m_groupCommitDurable = true;
+
+    m_resultCacheSize = 0;
+
+    m_laneReservedCount = 1;
+    m_laneBackgroundMaxCount = 0;
+    m_laneAgingTime = 1000;
+
+    m_slowQueryThreshold = -1;
+    m_slowQuerySampleRate = 0;
+    m_slowQueryLogMaxSize = 16 * 1024 * 1024;
+    m_slowQueryLogMaxFiles = 5;
+}
+
+// BulkLoadSettings
+BulkLoadSettings::BulkLoadSettings(const QString &table, const QStringList &columns, const char &delimiter)
+{
+    m_table = table;
+    m_columns = columns;
+    m_delimiter = delimiter;
+    m_quote = '"';
+    m_skipHeader = false;
+    m_rowsPerStatement = 0;
+    m_loadDataLocal = true;
+    m_progressInterval = 500;
+}
+
+// LatencySnapshot
+qint64 LatencySnapshot::percentile(const double &value) const
+{
+    if(!count) {
+        return 0;
+    }
+
+    const auto &&target = qMax<qint64>(1, qCeil(count * value / 100.0));
+    qint64 seen = 0;
+    for(int index = 0; index < buckets.size(); index++)
+    {
+        seen += buckets[index];
+        if(seen >= target) {
+            return qMin(max, LatencyHistogram::bucketUpperBound(index));
+        }
+    }
+    return max;
+}
+
+LatencySnapshot &LatencySnapshot::operator+=(const LatencySnapshot &other)
+{
+    count += other.count;
+    total += other.total;
+    max = qMax(max, other.max);
+
+    if(buckets.size() < other.buckets.size()) {
+        buckets.resize(other.buckets.size());
+    }
+    for(int index = 0; index < other.buckets.size(); index++)
+    {
+        buckets[index] += other.buckets[index];
+    }
+    return *this;
+}
+
+QJsonObject LatencySnapshot::toJson(void) const
+{
+    return QJsonObject({
+                           { "count", count },
+                           { "average", average() },
+                           { "p50", percentile(50) },
+                           { "p99", percentile(99) },
+                           { "p999", percentile(99.9) },
+                           { "max", max }
+                       });
+}
+
+QString LatencySnapshot::toText(void) const
+{
+    return QString("count=%1 avg=%2us p50=%3us p99=%4us p999=%5us max=%6us")
+            .arg(count).arg(average()).arg(percentile(50)).arg(percentile(99)).arg(percentile(99.9)).arg(max);
+}
+
+// LatencyHistogram
+void LatencyHistogram::record(const qint64 &value)
+{
+    const auto &&sample = qMax<qint64>(0, value);
+
+    m_bucket[bucketIndex(sample)].fetchAndAddRelaxed(1);
+    m_count.fetchAndAddRelaxed(1);
+    m_total.fetchAndAddRelaxed(sample);
+
+    auto current = m_max.load();
+    while((sample > current) && !m_max.testAndSetRelaxed(current, sample, current)) { }
+}
+
+LatencySnapshot LatencyHistogram::snapshot(void) const
+{
+    LatencySnapshot snapshot;
+    snapshot.count = m_count.load();
+    snapshot.total = m_total.load();
+    snapshot.max = m_max.load();
+
+    snapshot.buckets.resize(BucketCount);
+    for(int index = 0; index < BucketCount; index++)
+    {
+        snapshot.buckets[index] = m_bucket[index].load();
+    }
+    return snapshot;
+}
+
+int LatencyHistogram::bucketIndex(const qint64 &value)
+{
+    if(value < SubBucketCount) {
+        return int(value);
+    }
+
+    // 最高位决定所在的2的幂区间，其后SubBucketBits位决定子桶
+    const int &&shift = 63 - int(qCountLeadingZeroBits(quint64(value))) - SubBucketBits;
+    return (shift + 1) * SubBucketCount + int((value >> shift) & (SubBucketCount - 1));
+}
+
+qint64 LatencyHistogram::bucketUpperBound(const int &index)
+{
+    if(index < SubBucketCount) {
+        return index;
+    }
+
+    const int &&shift = index / SubBucketCount - 1;
+    return ((qint64(SubBucketCount + index % SubBucketCount) + 1) << shift) - 1;
+}
+
+// MetricsSnapshot
+MetricsSnapshot &MetricsSnapshot::operator+=(const MetricsSnapshot &other)
+{
+    lockWait += other.lockWait;
+    exec += other.exec;
+    execErrorCount += other.execErrorCount;
+    busyRetryCount += other.busyRetryCount;
+    createCount += other.createCount;
+    openCount += other.openCount;
+    openErrorCount += other.openErrorCount;
+    healthCheckCount += other.healthCheckCount;
+    healthCheckErrorCount += other.healthCheckErrorCount;
+    abortCount += other.abortCount;
+    return *this;
+}
+
+QJsonObject MetricsSnapshot::toJson(void) const
+{
+    return QJsonObject({
+                           { "name", name },
+                           { "lockWait", lockWait.toJson() },
+                           { "exec", exec.toJson() },
+                           { "execErrorCount", execErrorCount },
+                           { "busyRetryCount", busyRetryCount },
+                           { "createCount", createCount },
+                           { "openCount", openCount },
+                           { "openErrorCount", openErrorCount },
+                           { "healthCheckCount", healthCheckCount },
+                           { "healthCheckErrorCount", healthCheckErrorCount },
+                           { "abortCount", abortCount }
+                       });
+}
+
+QString MetricsSnapshot::toText(void) const
+{
+    return QString("%1\n"
+                   "  exec:     %2\n"
+                   "  lockWait: %3\n"
+                   "  execErrorCount=%4 busyRetryCount=%5 createCount=%6 openCount=%7 openErrorCount=%8 healthCheckCount=%9 healthCheckErrorCount=%10 abortCount=%11\n")
+            .arg(name).arg(exec.toText()).arg(lockWait.toText())
+            .arg(execErrorCount).arg(busyRetryCount).arg(createCount).arg(openCount).arg(openErrorCount)
+            .arg(healthCheckCount).arg(healthCheckErrorCount).arg(abortCount);
+}
+
+// SlowQueryStats
+QJsonObject SlowQueryStats::toJson(void) const
+{
+    return QJsonObject({
+                           { "fingerprint", fingerprint },
+                           { "sample", sample },
+                           { "count", count },
+                           { "slowCount", slowCount },
+                           { "errorCount", errorCount },
+                           { "totalTime", totalTime },
+                           { "maxTime", maxTime },
+                           { "averageTime", averageTime() }
+                       });
+}
+
+// MetricsReport
+QJsonObject MetricsReport::toJson(void) const
+{
+    QJsonArray connectionArray;
+    for(const auto &connection: connections)
+    {
+        connectionArray.append(connection.toJson());
+    }
+
+    QJsonArray slowQueryArray;
+    for(const auto &slowQuery: slowQueries)
+    {
+        slowQueryArray.append(slowQuery.toJson());
+    }
+
+    return QJsonObject({
+                           { "total", total.toJson() },
+                           { "connections", connectionArray },
+                           { "connectionCount", connectionCount },
+                           { "openConnectionCount", openConnectionCount },
+                           { "throttleWait", throttleWait.toJson() },
+                           { "poolWait", poolWait.toJson() },
+                           { "pool", QJsonObject({
+                                 { "size", pool.size },
+                                 { "idleSize", pool.idleSize },
+                                 { "checkoutCount", pool.checkoutCount },
+                                 { "timeoutCount", pool.timeoutCount },
+                                 { "waitCount", pool.waitCount },
+                                 { "interactiveLeasedSize", pool.leasedSize[InteractivePriority] },
+                                 { "backgroundLeasedSize", pool.leasedSize[BackgroundPriority] },
+                                 { "agedCount", pool.agedCount }
+                             }) },
+                           { "interactiveWait", interactiveWait.toJson() },
+                           { "backgroundWait", backgroundWait.toJson() },
+                           { "statementCache", QJsonObject({
+                                 { "hitCount", statementCache.hitCount },
+                                 { "missCount", statementCache.missCount },
+                                 { "hitRate", statementCache.hitRate() }
+                             }) },
+                           { "breaker", QJsonObject({
+                                 { "state", breaker.state },
+                                 { "failureCount", breaker.failureCount },
+                                 { "tripCount", breaker.tripCount },
+                                 { "rejectCount", breaker.rejectCount }
+                             }) },
+                           { "groupCommit", QJsonObject({
+                                 { "flushCount", groupCommit.flushCount },
+                                 { "statementCount", groupCommit.statementCount },
+                                 { "errorCount", groupCommit.errorCount },
+                                 { "rollbackCount", groupCommit.rollbackCount },
+                                 { "droppedCount", groupCommit.droppedCount },
+                                 { "averageBatchSize", groupCommit.averageBatchSize() },
+                                 { "lastError", groupCommit.lastError.text() },
+                                 { "lastErrorFingerprint", groupCommit.lastErrorFingerprint }
+                             }) },
+                           { "resultCache", QJsonObject({
+                                 { "hitCount", resultCache.hitCount },
+                                 { "missCount", resultCache.missCount },
+                                 { "hitRate", resultCache.hitRate() },
+                                 { "invalidateCount", resultCache.invalidateCount },
+                                 { "entryCount", resultCache.entryCount },
+                                 { "totalCost", resultCache.totalCost }
+                             }) },
+                           { "slowQueries", slowQueryArray }
+                       });
+}
+
+QString MetricsReport::toText(void) const
+{
+    QString text = total.toText();
+    text += QString("  connectionCount=%1 openConnectionCount=%2\n").arg(connectionCount).arg(openConnectionCount);
+    text += QString("  throttleWait: %1\n").arg(throttleWait.toText());
+    text += QString("  poolWait: %1 size=%2 idleSize=%3 timeoutCount=%4\n").arg(poolWait.toText()).arg(pool.size).arg(pool.idleSize).arg(pool.timeoutCount);
+    text += QString("  interactiveWait: %1 leasedSize=%2\n").arg(interactiveWait.toText()).arg(pool.leasedSize[InteractivePriority]);
+    text += QString("  backgroundWait: %1 leasedSize=%2 agedCount=%3\n").arg(backgroundWait.toText()).arg(pool.leasedSize[BackgroundPriority]).arg(pool.agedCount);
+    text += QString("  statementCache: hitCount=%1 missCount=%2 hitRate=%3\n").arg(statementCache.hitCount).arg(statementCache.missCount).arg(statementCache.hitRate());
+    text += QString("  breaker: state=%1 failureCount=%2 tripCount=%3 rejectCount=%4\n").arg(breaker.state).arg(breaker.failureCount).arg(breaker.tripCount).arg(breaker.rejectCount);
+    text += QString("  groupCommit: flushCount=%1 statementCount=%2 errorCount=%3 rollbackCount=%4 droppedCount=%5 averageBatchSize=%6\n")
+            .arg(groupCommit.flushCount).arg(groupCommit.statementCount).arg(groupCommit.errorCount).arg(groupCommit.rollbackCount)
+            .arg(groupCommit.droppedCount).arg(groupCommit.averageBatchSize(), 0, 'f', 1);
+    if(groupCommit.lastError.isValid()) {
+        text += QString("  groupCommit lastError: %1 %2\n").arg(groupCommit.lastError.text()).arg(groupCommit.lastErrorFingerprint);
+    }
+    text += QString("  resultCache: hitCount=%1 missCount=%2 hitRate=%3 invalidateCount=%4 entryCount=%5 totalCost=%6\n")
+            .arg(resultCache.hitCount).arg(resultCache.missCount).arg(resultCache.hitRate()).arg(resultCache.invalidateCount).arg(resultCache.entryCount).arg(resultCache.totalCost);
+    for(const auto &slowQuery: slowQueries)
+    {
+        text += QString("  slowQuery: count=%1 slowCount=%2 errorCount=%3 totalTime=%4us averageTime=%5us maxTime=%6us %7\n")
+                .arg(slowQuery.count).arg(slowQuery.slowCount).arg(slowQuery.errorCount)
+                .arg(slowQuery.totalTime).arg(slowQuery.averageTime()).arg(slowQuery.maxTime).arg(slowQuery.fingerprint);
+    }
+
+    for(const auto &connection: connections)
+    {
+        text += connection.toText();
+    }
+    return text;
+}
+
+// Throttle
+Throttle::Throttle(const QString &databaseType, const ConnectSettings &connectSettings):
+    m_sqlite(databaseType.startsWith("QSQLITE")),
+    m_rate(connectSettings.rateLimit() / 1000.0),
+    m_burst(qMax(1, connectSettings.rateBurst())),
+    m_retryCount(connectSettings.busyRetryCount()),
+    m_backoffTime(qMax(1, connectSettings.busyBackoffTime())),
+    m_backoffMaxTime(qMax(1, connectSettings.busyBackoffMaxTime())),
+    m_tokens(m_burst),
+    m_last(0)
+{
+    m_clock.start();
+}
+
+void Throttle::acquire(void)
+{
+    const auto &&pressure = m_pressure.load();
+    if(pressure > 0)
+    {
+        QThread::msleep(pressure);
+        m_wait.record(pressure * 1000);
+    }
+
+    if(m_rate <= 0) {
+        return;
+    }
+
+    // 预约式令牌桶：先扣除令牌，令牌为负时各线程在锁外等待各自的欠额
+    m_mutex.lock();
+
+    const auto &&now = m_clock.nsecsElapsed() / 1000;
+    m_tokens = qMin(m_burst, m_tokens + (now - m_last) * m_rate / 1000.0);
+    m_last = now;
+    m_tokens -= 1;
+    const auto &&deficit = -m_tokens;
+
+    m_mutex.unlock();
+
+    if(deficit > 0)
+    {
+        const auto &&waitTime = qint64(deficit / m_rate * 1000);
+        QThread::usleep(waitTime);
+        m_wait.record(waitTime);
+    }
+}
+
+bool Throttle::retry(const QSqlError &error, const int &attempt)
+{
+    if((attempt >= m_retryCount) || !isBusyError(error)) {
+        return false;
+    }
+
+    // 提高共享退避压力，使其他线程的新语句一同放缓
+    forever
+    {
+        const auto &&pressure = m_pressure.load();
+        const auto &&next = qMin(m_backoffMaxTime, qMax(m_backoffTime, pressure * 2));
+        if(m_pressure.testAndSetOrdered(pressure, next)) {
+            break;
+        }
+    }
+
+    const auto &&backoff = qMin(m_backoffMaxTime, m_backoffTime << qMin(attempt, 16));
+    QThread::msleep(backoff / 2 + QRandomGenerator::global()->bounded(backoff / 2 + 1));
+    return true;
+}
+
+void Throttle::success(void)
+{
+    auto pressure = m_pressure.load();
+    while(pressure > 0)
+    {
+        if(m_pressure.testAndSetOrdered(pressure, pressure / 2)) {
+            break;
+        }
+        pressure = m_pressure.load();
+    }
+}
+
+bool Throttle::isBusyError(const QSqlError &error) const
+{
+    const auto &&code = error.nativeErrorCode().toInt();
+    if(m_sqlite)
+    {
+        // 扩展错误码的低8位为主错误码：SQLITE_BUSY(5)、SQLITE_LOCKED(6)
+        if(((code & 0xff) == 5) || ((code & 0xff) == 6)) {
+            return true;
+        }
+    }
+    else
+    {
+        // MySql：锁等待超时(1205)、死锁(1213)
+        if((code == 1205) || (code == 1213)) {
+            return true;
+        }
+    }
+
+    return error.databaseText().contains("locked", Qt::CaseInsensitive);
+}
+
+// CircuitBreaker
+CircuitBreaker::CircuitBreaker(const ConnectSettings &connectSettings):
+    m_threshold(connectSettings.breakerThreshold()),
+    m_backoffTime(qMax(1, connectSettings.reconnectBackoffTime())),
+    m_backoffMaxTime(qMax(1, connectSettings.reconnectBackoffMaxTime())),
+    m_state(Closed),
+    m_failureCount(0),
+    m_backoffCount(0),
+    m_openUntil(0),
+    m_tripCount(0)
+{
+    m_clock.start();
+}
+
+bool CircuitBreaker::allow(void)
+{
+    if(m_threshold <= 0) {
+        return true;
+    }
+
+    m_mutex.lock();
+
+    bool flag = true;
+    if(m_state == Open)
+    {
+        // 熔断时间结束，当前请求作为试探
+        flag = m_clock.elapsed() >= m_openUntil;
+        if(flag) {
+            m_state = HalfOpen;
+        }
+    }
+    else if(m_state == HalfOpen)
+    {
+        // 试探请求尚未返回结果
+        flag = false;
+    }
+
+    m_mutex.unlock();
+
+    if(!flag) {
+        m_rejectCount.fetchAndAddRelaxed(1);
+    }
+    return flag;
+}
+
+void CircuitBreaker::success(void)
+{
+    m_mutex.lock();
+
+    m_state = Closed;
+    m_failureCount = 0;
+    m_backoffCount = 0;
+
+    m_mutex.unlock();
+}
+
+void CircuitBreaker::failure(void)
+{
+    if(m_threshold <= 0) {
+        return;
+    }
+
+    m_mutex.lock();
+
+    m_failureCount++;
+    if((m_state == HalfOpen) || (m_failureCount >= m_threshold))
+    {
+        const auto &&backoff = qMin(qint64(m_backoffMaxTime), qint64(m_backoffTime) << qMin(m_backoffCount, 16));
+        m_state = Open;
+        m_openUntil = m_clock.elapsed() + backoff;
+        m_backoffCount++;
+        m_tripCount++;
+    }
+
+    m_mutex.unlock();
+}
+
+CircuitBreaker::State CircuitBreaker::state(void) const
+{
+    m_mutex.lock();
+
+    auto state = m_state;
+    if((state == Open) && (m_clock.elapsed() >= m_openUntil)) {
+        state = HalfOpen;
+    }
+
+    m_mutex.unlock();
+    return state;
+}
+
+CircuitBreakerStats CircuitBreaker::stats(void) const
+{
+    CircuitBreakerStats stats;
+    stats.state = state();
+
+    m_mutex.lock();
+    stats.failureCount = m_failureCount;
+    stats.tripCount = m_tripCount;
+    m_mutex.unlock();
+
+    stats.rejectCount = m_rejectCount.load();
+    return stats;
+}
+
+// CancelToken
+CancelToken CancelToken::create(void)
+{
+    CancelToken token;
+    token.m_state = QSharedPointer<State>(new State);
+    return token;
+}
+
+void CancelToken::cancel(void)
+{
+    if(!m_state) {
+        return;
+    }
+
+    m_state->mutex.lock();
+    if(!m_state->cancelled.fetchAndStoreOrdered(1))
+    {
+        // 取消后不再有新的订阅，逐个取出回调并在锁外执行，unsubscribe()等待正在执行的回调
+        while(!m_state->callback.isEmpty())
+        {
+            const auto &&id = m_state->callback.firstKey();
+            const auto callback = m_state->callback.take(id);
+
+            m_state->running = id;
+            m_state->mutex.unlock();
+
+            callback();
+
+            m_state->mutex.lock();
+            m_state->running = -1;
+            m_state->finished.wakeAll();
+        }
+    }
+    else
+    {
+        // 其他线程正在取消时，等待其执行完回调
+        while(m_state->running >= 0)
+        {
+            m_state->finished.wait(&m_state->mutex);
+        }
+    }
+    m_state->mutex.unlock();
+}
+
+int CancelToken::subscribe(const std::function<void(void)> &callback)
+{
+    if(!m_state) {
+        return -1;
+    }
+
+    m_state->mutex.lock();
+
+    if(m_state->cancelled.load())
+    {
+        m_state->mutex.unlock();
+        return -1;
+    }
+
+    const auto &&id = m_state->serial++;
+    m_state->callback.insert(id, callback);
+
+    m_state->mutex.unlock();
+    return id;
+}
+
+void CancelToken::unsubscribe(const int &id)
+{
+    if(!m_state || (id < 0)) {
+        return;
+    }
+
+    m_state->mutex.lock();
+    m_state->callback.remove(id);
+    while(m_state->running == id)
+    {
+        m_state->finished.wait(&m_state->mutex);
+    }
+    m_state->mutex.unlock();
+}
+
+// Query
+Query::Query(void):
+    m_query(QSharedPointer<QSqlQuery>(new QSqlQuery(new NullResult)))
+{
+
+}
+
+Query::Query(QSharedPointer<QSqlDatabase> dataBase, QSharedPointer<QSqlQuery> statement, ConnectLease &&lease, QSharedPointer<Throttle> throttle, ConnectMetrics *metrics, const std::function<void(void)> &release):
+    m_query(statement ? statement : QSharedPointer<QSqlQuery>(new QSqlQuery(*dataBase))),
+    m_lease(std::move(lease)),
+    m_database(dataBase),
+    m_throttle(throttle),
+    m_release(release),
+    m_cached(!statement.isNull()),
+    m_metrics(metrics)
+{
+
+}
+
+Query::Query(Query &&other)
+{
+    swap(other);
+}
+
+Query::~Query(void)
+{
+    if(m_cached)
+    {
+        m_query->finish();
+    }
+
+    if(m_resultCache && m_written) {
+        m_resultCache->invalidate(m_writtenTables);
+    }
+
+    // 先归还连接点，再归还连接池
+    m_lease.release();
+
+    if(m_release)
+    {
+        m_release();
+    }
+}
+
+template<typename Function>
+bool Query::execute(const Function &function)
+{
+    // 无效的Query不执行，错误见lastError()
+    if(!isValid()) {
+        return false;
+    }
+
+    m_lease.adopt();
+
+    if(m_throttle) {
+        m_throttle->acquire();
+    }
+
+    QElapsedTimer timer;
+    if(m_metrics || m_slowQueryLog || m_execObserver) {
+        timer.start();
+    }
+
+    // 执行期间到期或被取消时，在驱动层中断语句
+    int watchdog = -1;
+    int subscription = -1;
+    if(m_interrupt)
+    {
+        if(!m_deadline.isForever()) {
+            watchdog = DeadlineWatchdog::instance().insert(m_deadline, m_interrupt);
+        }
+        subscription = m_token.subscribe(m_interrupt);
+    }
+
+    bool flag = false;
+    for(int attempt = 0; ; attempt++)
+    {
+        // 已到期或被取消时不再执行或重试
+        if(isAborted()) {
+            break;
+        }
+
+        flag = function();
+        if(flag || !m_throttle || !m_throttle->retry(m_query->lastError(), attempt)) {
+            break;
+        }
+
+        if(m_metrics) {
+            m_metrics->busyRetryCount.fetchAndAddRelaxed(1);
+        }
+    }
+
+    if(watchdog >= 0) {
+        DeadlineWatchdog::instance().remove(watchdog);
+    }
+    m_token.unsubscribe(subscription);
+
+    if(flag && m_throttle) {
+        m_throttle->success();
+    }
+
+    if(flag && m_resultCache) {
+        invalidate(m_query->lastQuery());
+    }
+
+    if(m_metrics)
+    {
+        m_metrics->exec.record(timer.nsecsElapsed() / 1000);
+        if(!flag) {
+            m_metrics->execErrorCount.fetchAndAddRelaxed(1);
+        }
+        if(!flag && isAborted()) {
+            m_metrics->abortCount.fetchAndAddRelaxed(1);
+        }
+    }
+
+    if(m_slowQueryLog) {
+        m_slowQueryLog->record(m_query->lastQuery(), timer.nsecsElapsed() / 1000, flag);
+    }
+
+    if(flag && m_execObserver) {
+        m_execObserver(timer.nsecsElapsed() / 1000);
+    }
+
+    return flag;
+}
+
+bool Query::exec(void)
+{
+    return execute([this]() { return m_query->exec(); });
+}
+
+bool Query::exec(const QString &sql)
+{
+    return execute([this, &sql]() { return m_query->exec(sql); });
+}
+
+BatchResult Query::execBatch(const QString &sql, const QList<QVariantList> &columns, const int &chunkSize)
+{
+    BatchResult result;
+
+    if(!isValid())
+    {
+        result.ok = false;
+        result.error = m_query->lastError();
+        return result;
+    }
+
+    const qint64 rows = columns.isEmpty() ? 0 : columns.first().size();
+    for(const auto &column: columns)
+    {
+        if(column.size() != rows)
+        {
+            result.ok = false;
+            result.error = QSqlError("Query::execBatch", "column size mismatch", QSqlError::StatementError);
+            return result;
+        }
+    }
+
+    if(!m_query->prepare(sql))
+    {
+        result.ok = false;
+        result.error = m_query->lastError();
+        return result;
+    }
+
+    const auto &&chunk = qMax(1, chunkSize);
+    const auto &&ownTransaction = m_database->transaction();
+
+    // 每个分块前设置保存点，分块失败时回到分块之前(驱动逐行模拟execBatch时出错前的行已执行，
+    // PostgreSql出错后事务只能回滚)，只逐行重放出错的分块以定位出错的行
+    QSqlQuery savepoint(*m_database);
+
+    for(qint64 offset = 0; offset < rows; offset += chunk)
+    {
+        const auto &&length = qMin<qint64>(chunk, rows - offset);
+        const auto &&saved = ownTransaction && savepoint.exec("SAVEPOINT multidatabase_batch");
+
+        if(!execChunk(columns, offset, length))
+        {
+            result.ok = false;
+            result.error = m_query->lastError();
+            result.failedChunk = offset / chunk;
+
+            if(ownTransaction)
+            {
+                if(saved && savepoint.exec("ROLLBACK TO SAVEPOINT multidatabase_batch")) {
+                    result.failedRow = locateFailedRow(columns, offset, length);
+                }
+                m_database->rollback();
+                result.chunkCount = 0;
+                result.rowCount = 0;
+            }
+            return result;
+        }
+
+        if(saved) {
+            savepoint.exec("RELEASE SAVEPOINT multidatabase_batch");
+        }
+
+        result.chunkCount++;
+        result.rowCount += length;
+    }
+
+    if(ownTransaction && !m_database->commit())
+    {
+        result.ok = false;
+        result.error = m_database->lastError();
+        m_database->rollback();
+        result.chunkCount = 0;
+        result.rowCount = 0;
+    }
+
+    return result;
+}
+
+bool Query::execChunk(const QList<QVariantList> &columns, const qint64 &offset, const qint64 &length)
+{
+    // 与exec()相同经过截止时间、繁忙重试、统计与慢查询日志，按位置绑定以便重试时覆盖上次的绑定
+    return execute([this, &columns, &offset, &length]()
+    {
+        for(int index = 0; index < columns.size(); index++)
+        {
+            m_query->bindValue(index, columns[index].mid(offset, length));
+        }
+        return m_query->execBatch();
+    });
+}
+
+qint64 Query::locateFailedRow(const QList<QVariantList> &columns, const qint64 &offset, const qint64 &length)
+{
+    // 已回到出错分块之前的保存点，逐行执行出错的分块，找到第一条失败的行，调用者随后回滚整个事务
+    for(qint64 row = offset; row < offset + length; row++)
+    {
+        if(isAborted()) {
+            break;
+        }
+
+        for(int index = 0; index < columns.size(); index++)
+        {
+            m_query->bindValue(index, columns[index].at(row));
+        }
+
+        if(!m_query->exec()) {
+            return row;
+        }
+    }
+
+    return -1;
+}
+
+ResultSet Query::resultSet(const bool &ok)
+{
+    ResultSet result;
+    result.ok = ok;
+
+    if(!ok)
+    {
+        result.error = m_query->lastError();
+        return result;
+    }
+
+    result.numRowsAffected = m_query->numRowsAffected();
+    result.lastInsertId = m_query->lastInsertId();
+
+    if(m_query->isSelect())
+    {
+        while(m_query->next())
+        {
+            result.rows.append(m_query->record());
+        }
+    }
+
+    return result;
+}
+
+void Query::swap(Query &other)
+{
+    m_query.swap(other.m_query);
+    m_lease.swap(other.m_lease);
+    m_database.swap(other.m_database);
+    m_throttle.swap(other.m_throttle);
+    m_release.swap(other.m_release);
+    qSwap(m_cached, other.m_cached);
+    qSwap(m_metrics, other.m_metrics);
+    qSwap(m_resultCache, other.m_resultCache);
+    qSwap(m_written, other.m_written);
+    m_writtenTables.swap(other.m_writtenTables);
+    qSwap(m_deadline, other.m_deadline);
+    qSwap(m_token, other.m_token);
+    m_interrupt.swap(other.m_interrupt);
+    qSwap(m_slowQueryLog, other.m_slowQueryLog);
+    m_execObserver.swap(other.m_execObserver);
+}
+
+void Query::invalidate(const QString &sql)
+{
+    if(Control::isReadStatement(sql)) {
+        return;
+    }
+
+    const auto &&tables = ResultCache::writeTables(sql);
+    m_resultCache->invalidate(tables);
+
+    // 析构时再次失效，覆盖事务提交前其他连接读到并缓存的旧数据
+    if(tables.isEmpty())
+    {
+        m_written = true;
+        m_writtenTables.clear();
+    }
+    else if(!m_written || !m_writtenTables.isEmpty())
+    {
+        m_written = true;
+        for(const auto &table: tables)
+        {
+            if(!m_writtenTables.contains(table)) {
+                m_writtenTables.append(table);
+            }
+        }
+    }
+}
+
+// ResultCache
+ResultCache::Entry::~Entry(void)
+{
+    // QCache淘汰或移除缓存项时调用，此时已持有m_mutex
+    cache->unlink(*this);
+}
+
+ResultCache::ResultCache(const int &budget):
+    m_cache(qMax(1, budget))
+{
+
+}
+
+QByteArray ResultCache::key(const QString &sql, const QVariantList &binds)
+{
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << sql << binds;
+    return key;
+}
+
+bool ResultCache::find(const QByteArray &key, ResultSet &result)
+{
+    m_mutex.lock();
+
+    const auto entry = m_cache.object(key);
+    if(entry) {
+        result = entry->result;
+    }
+
+    m_mutex.unlock();
+
+    (entry ? m_hitCount : m_missCount).fetchAndAddRelaxed(1);
+    return entry;
+}
+
+quint64 ResultCache::generation(const QStringList &tables)
+{
+    m_mutex.lock();
+
+    auto generation = m_globalGeneration;
+    for(const auto &table: tables)
+    {
+        generation += m_generation.value(table);
+    }
+
+    m_mutex.unlock();
+    return generation;
+}
+
+void ResultCache::insert(const QByteArray &key, const ResultSet &result, const QStringList &tables, const quint64 &generation)
+{
+    qint64 cost = sizeof(Entry) + key.size();
+    for(const auto &record: result.rows)
+    {
+        cost += Cursor::recordSize(record);
+    }
+
+    m_mutex.lock();
+
+    // 执行期间依赖的表被写入，结果可能已过期
+    auto current = m_globalGeneration;
+    for(const auto &table: tables)
+    {
+        current += m_generation.value(table);
+    }
+
+    if((current == generation) && (cost <= m_cache.maxCost()))
+    {
+        auto entry = new Entry;
+        entry->result = result;
+        entry->tables = tables;
+        entry->key = key;
+        entry->cache = this;
+
+        // 先移除旧项再登记依赖，避免旧项析构时注销新项的依赖
+        m_cache.remove(key);
+        for(const auto &table: tables)
+        {
+            m_dependency[table].insert(key);
+        }
+        m_cache.insert(key, entry, int(cost));
+    }
+
+    m_mutex.unlock();
+}
+
+void ResultCache::invalidate(const QStringList &tables)
+{
+    m_mutex.lock();
+
+    if(tables.isEmpty())
+    {
+        m_globalGeneration++;
+        m_invalidateCount.fetchAndAddRelaxed(m_cache.count());
+        m_cache.clear();
+        m_dependency.clear();
+    }
+    else
+    {
+        for(const auto &table: tables)
+        {
+            m_generation[table]++;
+
+            // 缓存项析构时会修改m_dependency，先取出
+            const auto &&keys = m_dependency.take(table);
+            for(const auto &key: keys)
+            {
+                if(m_cache.remove(key)) {
+                    m_invalidateCount.fetchAndAddRelaxed(1);
+                }
+            }
+        }
+    }
+
+    m_mutex.unlock();
+}
+
+ResultCacheStats ResultCache::stats(void)
+{
+    ResultCacheStats stats;
+    stats.hitCount = m_hitCount.load();
+    stats.missCount = m_missCount.load();
+    stats.invalidateCount = m_invalidateCount.load();
+
+    m_mutex.lock();
+    stats.entryCount = m_cache.count();
+    stats.totalCost = m_cache.totalCost();
+    m_mutex.unlock();
+
+    return stats;
+}
+
+QStringList ResultCache::readTables(const QString &sql)
+{
+    static const QRegularExpression from("\\bfrom\\s+(.+?)(?=\\b(where|group|order|limit|having|union|join|inner|left|right|cross|natural|on)\\b|\\)|;|$)",
+                                         QRegularExpression::CaseInsensitiveOption | QRegularExpression::DotMatchesEverythingOption);
+    static const QRegularExpression join("\\bjoin\\s+([^\\s,()]+)", QRegularExpression::CaseInsensitiveOption);
+
+    QStringList tables;
+    const auto &&append = [&tables](const QString &name)
+    {
+        // 去掉库名与引号
+        auto table = name.section('.', -1).remove(QRegularExpression("[`\"\\[\\]]")).toLower();
+        if(!table.isEmpty() && !tables.contains(table)) {
+            tables.append(table);
+        }
+    };
+
+    auto it = from.globalMatch(sql);
+    while(it.hasNext())
+    {
+        // from a, b as c
+        for(const auto &part: it.next().captured(1).split(','))
+        {
+            const auto &&name = part.trimmed().section(QRegularExpression("\\s+"), 0, 0);
+            if(name.startsWith('(')) {
+                // from后的子查询不解析，不缓存
+                return QStringList();
+            }
+            if(!name.isEmpty()) {
+                append(name);
+            }
+        }
+    }
+
+    it = join.globalMatch(sql);
+    while(it.hasNext())
+    {
+        append(it.next().captured(1));
+    }
+
+    return tables;
+}
+
+QStringList ResultCache::writeTables(const QString &sql)
+{
+    static const QRegularExpression write("\\b(?:(?:insert|replace)(?:\\s+or\\s+\\w+)?(?:\\s+ignore)?\\s+into|update(?:\\s+or\\s+\\w+)?|delete\\s+from|truncate(?:\\s+table)?|table(?:\\s+if(?:\\s+not)?\\s+exists)?)\\s+([^\\s,()]+)",
+                                          QRegularExpression::CaseInsensitiveOption);
+
+    QStringList tables;
+    auto it = write.globalMatch(sql);
+    while(it.hasNext())
+    {
+        const auto &&table = it.next().captured(1).section('.', -1).remove(QRegularExpression("[`\"\\[\\]]")).toLower();
+        if(!table.isEmpty() && !tables.contains(table)) {
+            tables.append(table);
+        }
+    }
+
+    return tables;
+}
+
+void ResultCache::unlink(const Entry &entry)
+{
+    for(const auto &table: entry.tables)
+    {
+        auto it = m_dependency.find(table);
+        if(it == m_dependency.end()) {
+            continue;
+        }
+
+        it->remove(entry.key);
+        if(it->isEmpty()) {
+            m_dependency.erase(it);
+        }
+    }
+}
+
+// Cursor
+Cursor::Cursor(Query &&query, const bool &ok, const int &chunkSize):
+    m_query(new Query(std::move(query))),
+    m_ok(ok),
+    m_chunkSize(qMax(1, chunkSize))
+{
+    if(!m_ok)
+    {
+        m_error = (*m_query)->lastError();
+        m_query.reset();
+    }
+}
+
+Cursor::iterator Cursor::begin(void)
+{
+    if(m_started) {
+        return (m_position < m_chunk.size()) ? iterator(this) : end();
+    }
+    m_started = true;
+
+    return fetch() ? iterator(this) : end();
+}
+
+bool Cursor::next(void)
+{
+    if(!m_started)
+    {
+        m_started = true;
+        return fetch();
+    }
+
+    m_position++;
+    if(m_position < m_chunk.size()) {
+        return true;
+    }
+
+    return fetch();
+}
+
+bool Cursor::fetch(void)
+{
+    // 先释放上一块再取下一块，内存中最多保留一块
+    m_chunk.clear();
+    m_position = 0;
+
+    if(!m_query) {
+        return false;
+    }
+
+    qint64 memory = 0;
+    while(m_chunk.size() < m_chunkSize)
+    {
+        if(!(*m_query)->next())
+        {
+            // 读完或取行出错，释放连接
+            m_error = (*m_query)->lastError();
+            m_query.reset();
+            break;
+        }
+
+        m_chunk.append((*m_query)->record());
+        memory += recordSize(m_chunk.last());
+    }
+
+    m_rowCount += m_chunk.size();
+    m_peakRows = qMax(m_peakRows, m_chunk.size());
+    m_peakChunkMemory = qMax(m_peakChunkMemory, memory);
+
+    return !m_chunk.isEmpty();
+}
+
+qint64 Cursor::recordSize(const QSqlRecord &record)
+{
+    qint64 size = sizeof(QSqlRecord);
+    for(int now = 0; now < record.count(); now++)
+    {
+        const auto &&value = record.value(now);
+        size += sizeof(QSqlField) + sizeof(QVariant);
+
+        switch(value.type())
+        {
+        case QVariant::String: {
+            size += value.toString().size() * qint64(sizeof(QChar));
+            break;
+        }
+        case QVariant::ByteArray: {
+            size += value.toByteArray().size();
+            break;
+        }
+        default: {
+            break;
+        }
+        }
+    }
+    return size;
+}
+
+// ConnectLease
+void ConnectLease::adopt(void)
+{
+    const auto &&thread = leaseThread();
+    if(!m_node || ((m_identity & Q_UINT64_C(0xFFFFFFFF00000000)) == thread)) {
+        return;
+    }
+
+    const auto &&identity = thread | (m_identity & Q_UINT64_C(0xFFFFFFFF));
+    if(m_node->m_owner.testAndSetOrdered(m_identity, identity)) {
+        m_identity = identity;
+    }
+}
+
+void ConnectLease::release(void)
+{
+    if(m_node)
+    {
+        m_node->unlease(m_identity);
+        m_node = nullptr;
+        m_identity = 0;
+    }
+}
+
+// ConnectNode
+ConnectNode::ConnectNode(const DatabaseSettings &dataBaseSettings, const ConnectSettings &connectSettings, const QSharedPointer<Throttle> &throttle, const QSharedPointer<CircuitBreaker> &breaker):
+    m_dataBaseSettings(dataBaseSettings),
+    m_connectSettings(connectSettings),
+    m_throttle(throttle),
+    m_breaker(breaker),
+    m_statementCache(qMax(0, connectSettings.statementCacheSize()))
+{
+    // 连接池中的连接点可能在同一线程中创建，连接名附加序号以保证唯一
+    static QAtomicInt serial;
+    m_connectionName = QString("%1(%2:%3)").arg(m_dataBaseSettings.connectionName()).arg(QString::number(qint64(QThread::currentThread()), 16)).arg(serial.fetchAndAddRelaxed(1));
+
+    if(m_connectSettings.enableMetrics()) {
+        m_metrics = QSharedPointer<ConnectMetrics>(new ConnectMetrics);
+    }
+
+    touch();
+    if(m_connectSettings.maxOpenTime() > 0) {
+        ConnectReaper::instance().insert(this);
+    }
+
+    createDataBase();
+}
+
+ConnectNode::~ConnectNode(void)
+{
+    if(m_connectSettings.maxOpenTime() > 0) {
+        ConnectReaper::instance().remove(this);
+    }
+    removeDataBase();
+}
+
+Query ConnectNode::query(const std::function<void(void)> &release, const QDeadlineTimer &deadline, const CancelToken &token)
+{
+    auto lease = this->lease(deadline, token);
+
+    if(!lease.isValid() || !check(lease))
+    {
+        lease.release();
+        if(release) {
+            release();
+        }
+
+        Query query;
+        query.m_deadline = deadline;
+        query.m_token = token;
+        return query;
+    }
+
+    touch();
+
+    Query query(m_database, QSharedPointer<QSqlQuery>(), std::move(lease), m_throttle, m_metrics.data(), release);
+    arm(query, deadline, token);
+    return query;
+}
+
+Query ConnectNode::prepared(const QString &sql, const std::function<void(void)> &release, const QDeadlineTimer &deadline, const CancelToken &token)
+{
+    auto lease = this->lease(deadline, token);
+
+    if(!lease.isValid() || !check(lease))
+    {
+        lease.release();
+        if(release) {
+            release();
+        }
+
+        Query query;
+        query.m_deadline = deadline;
+        query.m_token = token;
+        return query;
+    }
+
+    touch();
+
+    auto cached = m_statementCache.object(sql);
+    if(cached)
+    {
+        m_statementHit.fetchAndAddRelaxed(1);
+
+        Query query(m_database, *cached, std::move(lease), m_throttle, m_metrics.data(), release);
+        arm(query, deadline, token);
+        return query;
+    }
+    m_statementMiss.fetchAndAddRelaxed(1);
+
+    QSharedPointer<QSqlQuery> statement(new QSqlQuery(*m_database));
+    if(!statement->prepare(sql) || !m_connectSettings.statementCacheSize())
+    {
+        // prepare失败时不缓存，交由调用者从lastError()获取错误
+        Query query(m_database, statement, std::move(lease), m_throttle, m_metrics.data(), release);
+        query.m_cached = false;
+        arm(query, deadline, token);
+        return query;
+    }
+
+    m_statementCache.insert(sql, new QSharedPointer<QSqlQuery>(statement));
+
+    Query query(m_database, statement, std::move(lease), m_throttle, m_metrics.data(), release);
+    arm(query, deadline, token);
+    return query;
+}
+
+MetricsSnapshot ConnectNode::metrics(void) const
+{
+    MetricsSnapshot snapshot;
+    snapshot.name = m_connectionName;
+
+    if(m_metrics)
+    {
+        snapshot.lockWait = m_metrics->lockWait.snapshot();
+        snapshot.exec = m_metrics->exec.snapshot();
+        snapshot.execErrorCount = m_metrics->execErrorCount.load();
+        snapshot.busyRetryCount = m_metrics->busyRetryCount.load();
+        snapshot.createCount = m_metrics->createCount.load();
+        snapshot.openCount = m_metrics->openCount.load();
+        snapshot.openErrorCount = m_metrics->openErrorCount.load();
+        snapshot.healthCheckCount = m_metrics->healthCheckCount.load();
+        snapshot.healthCheckErrorCount = m_metrics->healthCheckErrorCount.load();
+        snapshot.abortCount = m_metrics->abortCount.load();
+    }
+
+    return snapshot;
+}
+
+StatementCacheStats ConnectNode::statementCacheStats(void) const
+{
+    StatementCacheStats stats;
+    stats.hitCount = m_statementHit.load();
+    stats.missCount = m_statementMiss.load();
+    return stats;
+}
+
+void ConnectNode::discard(void)
+{
+    m_discarded.store(1);
+
+    const auto &&lease = this->lease();
+    if(!lease.isValid()) {
+        return;
+    }
+
+    m_statementCache.clear();
+    if (m_database) {
+        m_database->close();
+    }
+}
+
+bool ConnectNode::createDataBase(void)
+{
+    const auto &&lease = this->lease();
+    return lease.isValid() && createDataBase(lease);
+}
+
+void ConnectNode::removeDataBase(void)
+{
+    const auto &&lease = this->lease();
+    if(lease.isValid()) {
+        removeDataBase(lease);
+    }
+}
+
+bool ConnectNode::open(void)
+{
+    const auto &&lease = this->lease();
+    return lease.isValid() && open(lease);
+}
+
+bool ConnectNode::createDataBase(const ConnectLease &lease)
+{
+    if(m_metrics) {
+        m_metrics->createCount.fetchAndAddRelaxed(1);
+    }
+
+    if(m_database) {
+        removeDataBase(lease);
+    }
+
+    if (!m_database) {
+        m_database = QSharedPointer<QSqlDatabase>(new QSqlDatabase(QSqlDatabase::addDatabase(m_dataBaseSettings.databaseType(), m_connectionName)));
+    }
+
+    m_database->setConnectOptions(m_dataBaseSettings.connectOptions());
+
+    switch(m_dataBaseSettings.databaseMode())
+    {
+    case DatabaseNameMode: {
+        m_database->setDatabaseName(m_dataBaseSettings.nameModeName());
+        break;
+    }
+    case DatabaseHostMode: {
+        m_database->setHostName(m_dataBaseSettings.hostModeHostName());
+        m_database->setDatabaseName(m_dataBaseSettings.hostModeDatabaseName());
+        m_database->setUserName(m_dataBaseSettings.hostModeUserName());
+        m_database->setPassword(m_dataBaseSettings.hostModePassword());
+        break;
+    }
+    default:{
+        return false;
+    }
+    }
+
+    return open(lease);
+}
+
+void ConnectNode::removeDataBase(const ConnectLease &lease)
+{
+    Q_UNUSED(lease);
+
+    m_statementCache.clear();
+
+    // 先释放持有的QSqlDatabase，否则removeDatabase()认为连接仍在使用而不释放
+    if(m_database)
+    {
+        m_database->close();
+        m_database.clear();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool ConnectNode::open(const ConnectLease &lease)
+{
+    if(!m_database) {
+        return createDataBase(lease);
+    }
+
+    touch();
+
+    // 熔断期间不尝试连接
+    if(m_breaker && !m_breaker->allow()) {
+        return false;
+    }
+
+    const bool flag = m_database->open();
+
+    if(m_breaker)
+    {
+        if(flag) {
+            m_breaker->success();
+        } else {
+            m_breaker->failure();
+        }
+    }
+
+    if(m_metrics) {
+        (flag ? m_metrics->openCount : m_metrics->openErrorCount).fetchAndAddRelaxed(1);
+    }
+
+    if(flag)
+    {
+        for(const auto &statement: m_dataBaseSettings.initStatements())
+        {
+            QSqlQuery query(*m_database);
+            if(!query.exec(statement)) {
+                qWarning() << "ConnectNode::open:" << statement << query.lastError().text();
+            }
+        }
+
+        // KILL QUERY需要连接在服务端的线程ID，每次(重新)连接后更新
+        if(m_dataBaseSettings.databaseType().startsWith("QMYSQL"))
+        {
+            QSqlQuery query(*m_database);
+            m_serverThreadId.store((query.exec("SELECT CONNECTION_ID()") && query.next()) ? query.value(0).toLongLong() : 0);
+        }
+    }
+
+    return flag;
+}
+
+ConnectLease ConnectNode::lease(const QDeadlineTimer &deadline, const CancelToken &token)
+{
+    const auto &&identity = leaseIdentity();
+
+    // 无竞争时只有一次比较交换，不读取时钟也不记录统计
+    if(m_owner.testAndSetAcquire(0, identity)) {
+        return ConnectLease(this, identity);
+    }
+
+    // 占用者是本线程持有的租约(移交其他线程的租约在那里首次执行时已改记)，嵌套的Query等待自己将永远不会返回
+    if((m_owner.load() >> 32) == (identity >> 32))
+    {
+        qWarning() << "ConnectNode::lease: connection already leased by this thread, nested Query is not supported," << m_connectionName;
+        return ConnectLease();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    bool flag = true;
+
+    // 取消时唤醒等待者，须在持有m_waitMutex前订阅，见CancelToken::cancel()
+    const auto &&subscription = token.subscribe([this]()
+    {
+        m_waitMutex.lock();
+        m_waitCondition.wakeAll();
+        m_waitMutex.unlock();
+    });
+
+    // 先登记等待者再重试，与unlease()中先归还再检查等待者相对，不会错过唤醒
+    m_waitMutex.lock();
+    m_waiterCount.fetchAndAddOrdered(1);
+    while(!m_owner.testAndSetOrdered(0, identity))
+    {
+        if(deadline.hasExpired() || token.isCancelled())
+        {
+            flag = false;
+            break;
+        }
+
+        const auto &&remaining = deadline.remainingTime();
+        if(remaining < 0) {
+            m_waitCondition.wait(&m_waitMutex);
+        } else {
+            m_waitCondition.wait(&m_waitMutex, static_cast<unsigned long>(remaining));
+        }
+    }
+    m_waiterCount.fetchAndAddOrdered(-1);
+    m_waitMutex.unlock();
+    token.unsubscribe(subscription);
+
+    if(m_metrics) {
+        m_metrics->lockWait.record(timer.nsecsElapsed() / 1000);
+    }
+    return flag ? ConnectLease(this, identity) : ConnectLease();
+}
+
+ConnectLease ConnectNode::tryLease(void)
+{
+    const auto &&identity = leaseIdentity();
+    return m_owner.testAndSetAcquire(0, identity) ? ConnectLease(this, identity) : ConnectLease();
+}
+
+void ConnectNode::unlease(const quint64 &identity)
+{
+    if(!m_owner.testAndSetOrdered(identity, 0)) {
+        qWarning() << "ConnectNode::unlease: lease not held," << m_connectionName;
+    }
+
+    if(m_waiterCount.load())
+    {
+        m_waitMutex.lock();
+        m_waitCondition.wakeOne();
+        m_waitMutex.unlock();
+    }
+}
+
+void ConnectNode::arm(Query &query, const QDeadlineTimer &deadline, const CancelToken &token)
+{
+    query.m_deadline = deadline;
+    query.m_token = token;
+
+    if(!deadline.isForever() || !token.isNull())
+    {
+        query.m_interrupt = interrupter();
+
+        static QAtomicInt warned;
+        if(!query.m_interrupt && !warned.fetchAndStoreRelaxed(1))
+        {
+            qWarning() << "ConnectNode::arm:" << m_dataBaseSettings.databaseType()
+                       << "statements cannot be interrupted, deadlines and cancellation only apply before execution"
+#ifndef MULTIDATABASE_SQLITE_INTERRUPT
+                       << "(define MULTIDATABASE_SQLITE_INTERRUPT for QSQLITE)"
+#endif
+                          ;
+        }
+    }
+}
+
+std::function<void(void)> ConnectNode::interrupter(void) const
+{
+    const auto &&databaseType = m_dataBaseSettings.databaseType();
+
+#ifdef MULTIDATABASE_SQLITE_INTERRUPT
+    if(databaseType.startsWith("QSQLITE") && m_database->driver())
+    {
+        const auto &&handle = m_database->driver()->handle();
+        if(handle.isValid() && !qstrcmp(handle.typeName(), "sqlite3*"))
+        {
+            const auto &&connection = *static_cast<sqlite3 *const *>(handle.constData());
+            if(connection) {
+                return [connection]() { sqlite3_interrupt(connection); };
+            }
+        }
+    }
+#endif
+
+    const auto &&threadId = m_serverThreadId.load();
+    if(databaseType.startsWith("QMYSQL") && threadId)
+    {
+        const auto databaseSettings = m_dataBaseSettings;
+        return [databaseSettings, threadId]() { killQuery(databaseSettings, threadId); };
+    }
+
+    return std::function<void(void)>();
+}
+
+bool ConnectNode::warmUp(const QString &statement)
+{
+    const auto &&lease = this->lease();
+    if(!lease.isValid()) {
+        return false;
+    }
+
+    if(!m_database) {
+        createDataBase(lease);
+    }
+
+    auto flag = m_database->isOpen() || open(lease);
+    if(flag && !statement.isEmpty())
+    {
+        QSqlQuery query(*m_database);
+        flag = query.exec(statement);
+        if(!flag) {
+            qWarning() << "ConnectNode::warmUp:" << statement << query.lastError().text();
+        }
+    }
+    touch();
+
+    return flag;
+}
+
+void ConnectNode::touch(void)
+{
+    m_lastUse.store(ConnectReaper::now());
+}
+
+bool ConnectNode::check(const ConnectLease &lease)
+{
+    if(!m_database) {
+        createDataBase(lease);
+    }
+
+    if(m_database->isOpen())
+    {
+        // 近期使用过的连接视为可用，不额外往返数据库
+        const auto &&idleTime = m_connectSettings.healthCheckIdleTime();
+        if((idleTime < 0) || ((ConnectReaper::now() - m_lastUse.load()) < idleTime)) {
+            return true;
+        }
+
+        if(ping()) {
+            return true;
+        }
+
+        // 连接已失效(如服务端断开、网络中断)，isOpen()无法发现，关闭后重连
+        qWarning() << "ConnectNode::check: connection lost," << m_connectionName;
+        m_statementCache.clear();
+        m_database->close();
+    }
+
+    return reconnect(lease);
+}
+
+bool ConnectNode::ping(void)
+{
+    QSqlQuery query(*m_database);
+    const auto &&flag = query.exec(m_connectSettings.healthCheckStatement().isEmpty() ? QString("SELECT 1") : m_connectSettings.healthCheckStatement());
+
+    if(m_metrics)
+    {
+        m_metrics->healthCheckCount.fetchAndAddRelaxed(1);
+        if(!flag) {
+            m_metrics->healthCheckErrorCount.fetchAndAddRelaxed(1);
+        }
+    }
+
+    return flag;
+}
+
+bool ConnectNode::reconnect(const ConnectLease &lease)
+{
+    const auto &&backoffTime = qMax(1, m_connectSettings.reconnectBackoffTime());
+    const auto &&backoffMaxTime = qMax(1, m_connectSettings.reconnectBackoffMaxTime());
+
+    for(int attempt = 0; ; attempt++)
+    {
+        if(open(lease)) {
+            return true;
+        }
+
+        // 熔断后其他调用者已在快速失败，不再继续重试
+        if((attempt >= m_connectSettings.reconnectRetryCount()) || (m_breaker && (m_breaker->state() != CircuitBreaker::Closed))) {
+            return false;
+        }
+
+        const auto &&backoff = qMin(backoffMaxTime, backoffTime << qMin(attempt, 16));
+        QThread::msleep(backoff / 2 + QRandomGenerator::global()->bounded(backoff / 2 + 1));
+    }
+}
+
+bool ConnectNode::isOpen(void)
+{
+    const auto &&lease = tryLease();
+    if(!lease.isValid()) {
+        return true;
+    }
+
+    return m_database && m_database->isOpen();
+}
+
+bool ConnectNode::closeIfIdle(const qint64 &now)
+{
+    if((m_connectSettings.maxOpenTime() <= 0) || ((now - m_lastUse.load()) < m_connectSettings.maxOpenTime())) {
+        return false;
+    }
+
+    // 连接正被Query占用时跳过，下次扫描再检查
+    const auto &&lease = tryLease();
+    if(!lease.isValid()) {
+        return false;
+    }
+
+    const auto &&flag = m_database && m_database->isOpen();
+    if(flag)
+    {
+        m_statementCache.clear();
+        m_database->close();
+    }
+
+    return flag;
+}
+
+void ConnectNode::close(void)
+{
+    const auto &&lease = tryLease();
+    if(!lease.isValid()) {
+        return;
+    }
+
+    // 关闭数据库会使已prepare的语句失效
+    m_statementCache.clear();
+    if (m_database) {
+        m_database->close();
+    }
+}
+
+// ConnectPool
+ConnectPool::ConnectPool(const DatabaseSettings &databaseSettings, const ConnectSettings &connectSettings, const QSharedPointer<Throttle> &throttle, const QSharedPointer<CircuitBreaker> &breaker):
+    m_databaseSettings(databaseSettings),
+    m_connectSettings(connectSettings),
+    m_throttle(throttle),
+    m_breaker(breaker),
+    m_size(0)
+{
+    if(m_connectSettings.poolMaxSize() < 1) {
+        m_connectSettings.setPoolMaxSize(1);
+    }
+    if(m_connectSettings.poolMinSize() > m_connectSettings.poolMaxSize()) {
+        m_connectSettings.setPoolMinSize(m_connectSettings.poolMaxSize());
+    }
+
+    // 保留laneReservedCount个连接给InteractivePriority，但BackgroundPriority至少可以使用1个连接
+    const auto &&shared = m_connectSettings.poolMaxSize() - qMax(0, m_connectSettings.laneReservedCount());
+    const auto &&configured = m_connectSettings.laneBackgroundMaxCount();
+    m_backgroundMaxCount = qMax(1, (configured > 0) ? qMin(configured, shared) : shared);
+
+    for(int index = 0; index < PriorityCount; index++)
+    {
+        m_leased[index] = 0;
+        m_waiting[index] = 0;
+    }
+
+    warmUp(m_connectSettings.poolMinSize(), QString());
+}
+
+ConnectPool::~ConnectPool(void)
+{
+    destroyAllConnection();
+}
+
+Query ConnectPool::query(const QString &preparedSql, const QueryPriority &priority, const QDeadlineTimer &deadline, const CancelToken &token)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    ConnectNode *node = nullptr;
+    bool create = false;
+    bool waited = false;
+
+    // 调度时所在的优先级，BackgroundPriority等待超过laneAgingTime后提升为InteractivePriority
+    auto lane = priority;
+    auto waitingLane = PriorityCount;
+    const auto &&agingTime = m_connectSettings.laneAgingTime();
+
+    // 取消时唤醒等待者，须在持有m_mutex前订阅，见CancelToken::cancel()
+    const auto &&subscription = token.subscribe([this]()
+    {
+        m_mutex.lock();
+        m_condition.wakeAll();
+        m_mutex.unlock();
+    });
+
+    m_mutex.lock();
+
+    forever
+    {
+        if(deadline.hasExpired() || token.isCancelled()) {
+            break;
+        }
+
+        if((lane == BackgroundPriority) && (agingTime >= 0) && (timer.elapsed() >= agingTime))
+        {
+            lane = InteractivePriority;
+            m_stats.agedCount++;
+        }
+
+        // BackgroundPriority不超过占用上限，且在InteractivePriority等待时让出连接
+        const auto &&admitted = (priority == InteractivePriority) ||
+                ((m_leased[BackgroundPriority] < m_backgroundMaxCount) && ((lane == InteractivePriority) || !m_waiting[InteractivePriority]));
+
+        if(admitted)
+        {
+            if(!m_idleNode.isEmpty()) {
+                // 后进先出，使常用连接保持活跃，多余的连接空置后自动断开
+                node = m_idleNode.takeLast();
+                break;
+            }
+
+            if(m_size < m_connectSettings.poolMaxSize()) {
+                m_size++;
+                m_creating++;
+                create = true;
+                break;
+            }
+        }
+
+        if(waitingLane != lane)
+        {
+            if(waitingLane != PriorityCount) {
+                m_waiting[waitingLane]--;
+            }
+            m_waiting[lane]++;
+            waitingLane = lane;
+        }
+        waited = true;
+
+        qint64 timeout = -1;
+        if(m_connectSettings.poolWaitTime() >= 0)
+        {
+            timeout = m_connectSettings.poolWaitTime() - timer.elapsed();
+            if(timeout <= 0) {
+                break;
+            }
+        }
+        if((lane == BackgroundPriority) && (agingTime >= 0))
+        {
+            // 到期时醒来提升优先级
+            const auto &&aging = qMax<qint64>(1, agingTime - timer.elapsed());
+            timeout = (timeout < 0) ? aging : qMin(timeout, aging);
+        }
+        if(!deadline.isForever())
+        {
+            const auto &&remaining = qMax<qint64>(1, deadline.remainingTime());
+            timeout = (timeout < 0) ? remaining : qMin(timeout, remaining);
+        }
+
+        if(timeout < 0) {
+            m_condition.wait(&m_mutex);
+        } else {
+            m_condition.wait(&m_mutex, timeout);
+        }
+    }
+
+    if(waitingLane != PriorityCount)
+    {
+        m_waiting[waitingLane]--;
+
+        // 最后一个InteractivePriority等待者离开，让出连接的BackgroundPriority可以继续
+        if((waitingLane == InteractivePriority) && !m_waiting[InteractivePriority]) {
+            m_condition.wakeAll();
+        }
+    }
+
+    const auto &&waitTime = timer.nsecsElapsed() / 1000;
+    if(node || create) {
+        m_stats.checkoutCount++;
+        m_leased[priority]++;
+    } else {
+        m_stats.timeoutCount++;
+    }
+    if(waited) {
+        m_stats.waitCount++;
+    }
+    m_stats.totalWaitTime += waitTime;
+    m_stats.maxWaitTime = qMax(m_stats.maxWaitTime, waitTime);
+    m_wait.record(waitTime);
+    m_laneWait[priority].record(waitTime);
+
+    m_mutex.unlock();
+    token.unsubscribe(subscription);
+
+    if(create)
+    {
+        // 创建连接可能需要较长时间(如MySql握手)，不在持有锁时进行
+        node = new ConnectNode(m_databaseSettings, m_connectSettings, m_throttle, m_breaker);
+
+        m_mutex.lock();
+        m_node.append(node);
+        m_creating--;
+        m_condition.wakeAll();
+        m_mutex.unlock();
+    }
+
+    if(!node)
+    {
+        Query query;
+        query.m_deadline = deadline;
+        query.m_token = token;
+        return query;
+    }
+
+    // 持有连接池的引用，Query比Control存在更久时归还仍然安全
+    const auto pool = sharedFromThis();
+    const auto &&release = [pool, node, priority]() { pool->release(node, priority); };
+    return preparedSql.isEmpty() ? node->query(release, deadline, token) : node->prepared(preparedSql, release, deadline, token);
+}
+
+int ConnectPool::warmUp(const int &count, const QString &statement)
+{
+    m_mutex.lock();
+    const auto &&create = qMax(0, qMin(count, m_connectSettings.poolMaxSize()) - m_size);
+    m_size += create;
+    m_creating += create;
+    m_mutex.unlock();
+
+    int succeeded = 0;
+    const auto &&node = openConnectNodes(create, m_databaseSettings, m_connectSettings, m_throttle, m_breaker, statement, &succeeded);
+
+    m_mutex.lock();
+    m_node.append(node);
+    m_idleNode.append(node);
+    m_creating -= create;
+    m_condition.wakeAll();
+    m_mutex.unlock();
+
+    return succeeded;
+}
+
+void ConnectPool::destroyAllConnection(void)
+{
+    m_mutex.lock();
+
+    // 正在创建的连接点已计入m_size但尚未加入m_node，等待其加入，避免遗漏
+    while(m_creating)
+    {
+        m_condition.wait(&m_mutex);
+    }
+
+    for(const auto &node: m_idleNode)
+    {
+        m_node.removeOne(node);
+        delete node;
+        m_size--;
+    }
+    m_idleNode.clear();
+
+    // 正在借出的连接点在归还时销毁
+    m_node.clear();
+
+    m_mutex.unlock();
+}
+
+PoolStats ConnectPool::stats(void)
+{
+    m_mutex.lock();
+
+    auto stats = m_stats;
+    stats.size = m_size;
+    stats.idleSize = m_idleNode.size();
+    for(int index = 0; index < PriorityCount; index++)
+    {
+        stats.leasedSize[index] = m_leased[index];
+    }
+
+    m_mutex.unlock();
+    return stats;
+}
+
+void ConnectPool::forEach(const std::function<void(ConnectNode *)> &function)
+{
+    m_mutex.lock();
+
+    for(const auto &node: m_node)
+    {
+        function(node);
+    }
+
+    m_mutex.unlock();
+}
+
+void ConnectPool::release(ConnectNode *node, const QueryPriority &priority)
+{
+    m_mutex.lock();
+
+    m_leased[priority]--;
+
+    if(m_node.contains(node)) {
+        m_idleNode.append(node);
+    } else {
+        delete node;
+        m_size--;
+    }
+
+    // 等待者的准入条件与优先级有关，唤醒全部由其自行判断
+    m_condition.wakeAll();
+    m_mutex.unlock();
+}
+
+// Control
+Control::Control(const DatabaseSettings &databaseSettings, const ConnectSettings &connectSettings):
+    m_databaseSettings(databaseSettings),
+    m_connectSettings(connectSettings),
+    m_registry(new ConnectRegistry)
+{
+    static QAtomicInt serial;
+    m_id = serial.fetchAndAddRelaxed(1);
+
+    if(m_connectSettings.queryMode() == QueryAutoMode)
+    {
+        if(databaseSettings.databaseType() == "QMYSQL") {
+            m_connectSettings.setQueryMode(QueryMultiMode);
+        } else if(databaseSettings.databaseType() == "QODBC") {
+            m_connectSettings.setQueryMode(QueryMultiMode);
+        } else {
+            m_connectSettings.setQueryMode(QuerySingleMode);
+        }
+    }
+
+    // 兼容旧配置：minWaitTime换算为令牌桶速率。未配置时不再设置固定的最小查询间隔，仅在驱动报告繁忙时退避
+    if((m_connectSettings.minWaitTime() > 0) && (m_connectSettings.rateLimit() <= 0))
+    {
+        m_connectSettings.setRateLimit(qMax(1, 1000 / m_connectSettings.minWaitTime()));
+        m_connectSettings.setRateBurst(1);
+    }
+    m_throttle = QSharedPointer<Throttle>(new Throttle(m_databaseSettings.databaseType(), m_connectSettings));
+    m_breaker = QSharedPointer<CircuitBreaker>(new CircuitBreaker(m_connectSettings));
+
+    if(m_connectSettings.resultCacheSize() > 0) {
+        m_resultCache = QSharedPointer<ResultCache>(new ResultCache(m_connectSettings.resultCacheSize()));
+    }
+
+    if(m_connectSettings.slowQueryThreshold() >= 0) {
+        m_slowQueryLog = QSharedPointer<SlowQueryLog>(new SlowQueryLog(m_connectSettings));
+    }
+
+    if((m_connectSettings.queryMode() == QueryWalMode) && !m_databaseSettings.databaseType().startsWith("QSQLITE"))
+    {
+        qWarning() << "Control::Control: QueryWalMode only supports QSQLITE, fall back to QuerySingleMode";
+        m_connectSettings.setQueryMode(QuerySingleMode);
+    }
+
+    if(m_connectSettings.asyncThreadCount() <= 0)
+    {
+        switch(m_connectSettings.queryMode())
+        {
+        case QueryPoolMode: {
+            m_connectSettings.setAsyncThreadCount(m_connectSettings.poolMaxSize());
+            break;
+        }
+        case QueryWalMode: {
+            m_connectSettings.setAsyncThreadCount(m_connectSettings.walReaderCount() + 1);
+            break;
+        }
+        case QuerySingleMode: {
+            m_connectSettings.setAsyncThreadCount(1);
+            break;
+        }
+        default: {
+            m_connectSettings.setAsyncThreadCount(QThread::idealThreadCount());
+            break;
+        }
+        }
+    }
+    m_executor.setMaxThreadCount(qMax(1, m_connectSettings.asyncThreadCount()));
+    m_executor.setExpiryTimeout(-1);
+
+    if(m_connectSettings.queryMode() == QuerySingleMode)
+    {
+        m_node = QSharedPointer<ConnectNode>(new ConnectNode(m_databaseSettings, m_connectSettings, m_throttle, m_breaker));
+    }
+    else if(m_connectSettings.queryMode() == QueryPoolMode)
+    {
+        m_pool = QSharedPointer<ConnectPool>(new ConnectPool(m_databaseSettings, m_connectSettings, m_throttle, m_breaker));
+    }
+    else if(m_connectSettings.queryMode() == QueryWalMode)
+    {
+        // 写连接先打开并切换为WAL日志(持久保存在数据库文件中)，数据库文件不存在时同时创建，之后只读连接才能打开
+        auto writerSettings = m_databaseSettings;
+        writerSettings.setInitStatements(QStringList() << "PRAGMA journal_mode=WAL" << writerSettings.initStatements());
+        m_node = QSharedPointer<ConnectNode>(new ConnectNode(writerSettings, m_connectSettings, m_throttle, m_breaker));
+
+        auto readerSettings = m_databaseSettings;
+        QStringList readerOptions("QSQLITE_OPEN_READONLY");
+        if(!readerSettings.connectOptions().isEmpty()) {
+            readerOptions << readerSettings.connectOptions();
+        }
+        readerSettings.setConnectOptions(readerOptions.join(';'));
+
+        auto readerConnectSettings = m_connectSettings;
+        readerConnectSettings.setPoolMaxSize(qMax(1, m_connectSettings.walReaderCount()));
+        readerConnectSettings.setPoolMinSize(qMin(m_connectSettings.poolMinSize(), readerConnectSettings.poolMaxSize()));
+
+        m_pool = QSharedPointer<ConnectPool>(new ConnectPool(readerSettings, readerConnectSettings, m_throttle, m_breaker));
+    }
+
+    if((m_connectSettings.warmUpCount() > 0) || !m_connectSettings.warmUpStatement().isEmpty())
+    {
+        if(m_connectSettings.warmUpInBackground()) {
+            m_warmUp = QtConcurrent::run(&m_executor, [this]() { return warmUp(); });
+        } else {
+            const auto &&succeeded = warmUp();
+
+            QFutureInterface<int> result(QFutureInterfaceBase::Started);
+            result.reportFinished(&succeeded);
+            m_warmUp = result.future();
+        }
+    }
+}
+
+Control::~Control(void)
+{
+    m_groupCommit.reset();
+    m_executor.waitForDone();
+    destroyAllConnection();
+}
+
+void Control::destroyAllConnection(void)
+{
+    // discard()与连接点析构需等待正在使用的Query归还，在锁外进行：持有Query的线程可能正等待这两个锁(如metrics())
+    QSharedPointer<ConnectNode> single;
+    QList<QSharedPointer<ConnectNode>> registered;
+
+    m_mutex.lock();
+
+    single.swap(m_node);
+
+    if(m_pool) {
+        m_pool->destroyAllConnection();
+    }
+
+    m_registry->mutex.lock();
+    registered.swap(m_registry->node);
+    m_registry->spare.clear();
+    m_registry->mutex.unlock();
+
+    m_mutex.unlock();
+
+    // 线程本地缓存仍持有连接点句柄，此处关闭连接并标记废弃，由各线程下次查询时或线程结束时释放
+    for(const auto &node: registered)
+    {
+        node->discard();
+    }
+}
+
+Query Control::query(const QueryPriority &priority)
+{
+    return acquire(false, QString(), priority);
+}
+
+Query Control::query(const QString &statement, const QueryPriority &priority)
+{
+    return acquire(isReadStatement(statement), QString(), priority);
+}
+
+Query Control::readQuery(const QueryPriority &priority)
+{
+    return acquire(true, QString(), priority);
+}
+
+Query Control::writeQuery(const QueryPriority &priority)
+{
+    return acquire(false, QString(), priority);
+}
+
+Query Control::prepared(const QString &sql, const QueryPriority &priority)
+{
+    return acquire(isReadStatement(sql), sql, priority);
+}
+
+Query Control::query(const QDeadlineTimer &deadline, const CancelToken &token, const QueryPriority &priority)
+{
+    return acquire(false, QString(), priority, deadline, token);
+}
+
+Query Control::query(const QString &statement, const QDeadlineTimer &deadline, const CancelToken &token, const QueryPriority &priority)
+{
+    return acquire(isReadStatement(statement), QString(), priority, deadline, token);
+}
+
+Query Control::prepared(const QString &sql, const QDeadlineTimer &deadline, const CancelToken &token, const QueryPriority &priority)
+{
+    return acquire(isReadStatement(sql), sql, priority, deadline, token);
+}
+
+BatchResult Control::execBatch(const QString &sql, const QList<QVariantList> &columns, const int &chunkSize)
+{
+    auto query = writeQuery();
+    if(!query.isValid())
+    {
+        BatchResult result;
+        result.ok = false;
+        result.error = query->lastError();
+        return result;
+    }
+
+    return query.execBatch(sql, columns, (chunkSize > 0) ? chunkSize : m_connectSettings.batchChunkSize());
+}
+
+BulkLoadResult Control::bulkLoad(const QString &path, const BulkLoadSettings &settings, const std::function<void(const BulkLoadProgress &)> &progress, const CancelToken &token)
+{
+    BulkLoadResult result;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const auto &&columnCount = settings.columns().size();
+    if(settings.table().isEmpty() || !columnCount)
+    {
+        result.ok = false;
+        result.error = QSqlError("Control::bulkLoad", "table or columns is empty", QSqlError::StatementError);
+        return result;
+    }
+
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        result.ok = false;
+        result.error = QSqlError("Control::bulkLoad", file.errorString(), QSqlError::UnknownError);
+        return result;
+    }
+    result.progress.bytesTotal = file.size();
+
+    auto query(writeQuery(BackgroundPriority));
+    if(!query.isValid() || !query.transaction())
+    {
+        result.ok = false;
+        result.error = query.isValid() ? query.lastDatabaseError() : QSqlError("Control::bulkLoad", "no connection available", QSqlError::ConnectionError);
+        return result;
+    }
+
+    const auto &&databaseType = m_databaseSettings.databaseType();
+
+    // 由服务端直接读取文件，客户端不解析
+    if(settings.loadDataLocal() && databaseType.startsWith("QMYSQL"))
+    {
+        const auto &&head = file.peek(64 * 1024);
+        const auto &&newline = head.indexOf('\n');
+
+        if(query.exec(loadDataStatement(path, settings, (newline > 0) && (head[newline - 1] == '\r'))))
+        {
+            result.loadDataLocal = true;
+            result.progress.rowCount = query->numRowsAffected();
+            result.progress.bytesRead = result.progress.bytesTotal;
+        }
+        else
+        {
+            qWarning() << "Control::bulkLoad: LOAD DATA LOCAL INFILE failed, fall back to insert," << query->lastError().text();
+
+            query.rollback();
+            if(!query.transaction())
+            {
+                result.ok = false;
+                result.error = query.lastDatabaseError();
+                return result;
+            }
+        }
+    }
+
+    if(!result.loadDataLocal && file.size())
+    {
+        const auto data = reinterpret_cast<const char *>(file.map(0, file.size()));
+        if(!data)
+        {
+            query.rollback();
+            result.ok = false;
+            result.error = QSqlError("Control::bulkLoad", file.errorString(), QSqlError::UnknownError);
+            return result;
+        }
+
+        // 每条语句的占位符数不超过驱动上限：Sqlite默认999，SqlServer为2100
+        const auto &&parameterLimit = databaseType.startsWith("QSQLITE") ? 999 : (databaseType.startsWith("QODBC") ? 2100 : 65535);
+        const auto &&rowLimit = qMax(1, parameterLimit / columnCount);
+        const auto &&rowsPerStatement = (settings.rowsPerStatement() > 0) ? qMin(settings.rowsPerStatement(), rowLimit) : qMin(1000, rowLimit);
+        const auto &&fullStatement = multiRowInsert(settings.table(), settings.columns(), rowsPerStatement);
+
+        DelimitedReader reader(data, file.size(), settings.delimiter(), settings.quote());
+        QVarLengthArray<DelimitedReader::Field, 16> fields;
+        if(settings.skipHeader()) {
+            reader.readRow(fields);
+        }
+
+        QVector<QVariant> values;
+        values.reserve(rowsPerStatement * columnCount);
+
+        qint64 row = 0;
+        qint64 lastReport = 0;
+        bool fullPrepared = false;
+
+        // 执行已绑定的rows行，完整的分块复用同一条预编译语句
+        const auto &&flush = [&](const int &rows)
+        {
+            auto ok = true;
+            if(rows == rowsPerStatement)
+            {
+                if(!fullPrepared) {
+                    ok = fullPrepared = query->prepare(fullStatement);
+                }
+            }
+            else
+            {
+                fullPrepared = false;
+                ok = query->prepare(multiRowInsert(settings.table(), settings.columns(), rows));
+            }
+
+            if(ok)
+            {
+                for(const auto &value: values)
+                {
+                    query->addBindValue(value);
+                }
+                ok = query.exec();
+            }
+            values.clear();
+
+            if(!ok)
+            {
+                result.ok = false;
+                result.error = query->lastError();
+                result.failedRow = row - rows;
+                return;
+            }
+
+            result.progress.rowCount += rows;
+            result.progress.bytesRead = reader.offset();
+            result.progress.elapsed = timer.elapsed();
+            if(progress && (result.progress.elapsed - lastReport >= settings.progressInterval()))
+            {
+                lastReport = result.progress.elapsed;
+                progress(result.progress);
+            }
+        };
+
+        while(result.ok && reader.readRow(fields))
+        {
+            if(fields.size() != columnCount)
+            {
+                result.ok = false;
+                result.error = QSqlError("Control::bulkLoad", QString("expected %1 fields, got %2").arg(columnCount).arg(fields.size()), QSqlError::StatementError);
+                result.failedRow = row;
+                break;
+            }
+
+            for(const auto &field: fields)
+            {
+                values.append(reader.value(field));
+            }
+            row++;
+
+            if(values.size() == rowsPerStatement * columnCount)
+            {
+                if(token.isCancelled())
+                {
+                    result.ok = false;
+                    result.error = QSqlError("Control::bulkLoad", "cancelled", QSqlError::UnknownError);
+                    break;
+                }
+                flush(rowsPerStatement);
+            }
+        }
+
+        if(result.ok && !values.isEmpty()) {
+            flush(values.size() / columnCount);
+        }
+    }
+
+    if(result.ok && !query.commit())
+    {
+        result.ok = false;
+        result.error = query.lastDatabaseError();
+    }
+
+    if(!result.ok)
+    {
+        query.rollback();
+        result.progress.rowCount = 0;
+    }
+
+    result.rowCount = result.progress.rowCount;
+    result.progress.elapsed = timer.elapsed();
+    if(progress) {
+        progress(result.progress);
+    }
+
+    return result;
+}
+
+ResultSet Control::exec(const QString &sql, const QVariantList &binds)
+{
+    if(m_resultCache && isReadStatement(sql)) {
+        return cached(sql, binds, QStringList());
+    }
+
+    return execute(sql, binds);
+}
+
+ResultSet Control::cached(const QString &sql, const QVariantList &binds, const QStringList &tables)
+{
+    if(!m_resultCache) {
+        return execute(sql, binds);
+    }
+
+    QStringList dependency;
+    for(const auto &table: tables)
+    {
+        dependency.append(table.toLower());
+    }
+    if(dependency.isEmpty()) {
+        dependency = ResultCache::readTables(sql);
+    }
+    if(dependency.isEmpty()) {
+        return execute(sql, binds);
+    }
+
+    const auto &&key = ResultCache::key(sql, binds);
+
+    ResultSet result;
+    if(m_resultCache->find(key, result)) {
+        return result;
+    }
+
+    const auto &&generation = m_resultCache->generation(dependency);
+    result = execute(sql, binds);
+    if(result.ok) {
+        m_resultCache->insert(key, result, dependency, generation);
+    }
+
+    return result;
+}
+
+void Control::invalidate(const QStringList &tables)
+{
+    if(!m_resultCache) {
+        return;
+    }
+
+    QStringList target;
+    for(const auto &table: tables)
+    {
+        target.append(table.toLower());
+    }
+    m_resultCache->invalidate(target);
+}
+
+ResultCacheStats Control::resultCacheStats(void)
+{
+    return m_resultCache ? m_resultCache->stats() : ResultCacheStats();
+}
+
+ResultSet Control::execute(const QString &sql, const QVariantList &binds)
+{
+    auto query(prepared(sql));
+
+    for(const auto &value: binds)
+    {
+        query->addBindValue(value);
+    }
+
+    return query.resultSet(query.exec());
+}
+
+QFuture<ResultSet> Control::execAsync(const QString &sql, const QVariantList &binds)
+{
+    return QtConcurrent::run(&m_executor, [this, sql, binds]() { return exec(sql, binds); });
+}
+
+QFuture<ResultSet> Control::enqueue(const QString &sql, const QVariantList &binds)
+{
+    m_mutex.lock();
+    if(!m_groupCommit) {
+        m_groupCommit = QSharedPointer<GroupCommitQueue>(new GroupCommitQueue(this, m_connectSettings));
+    }
+    const auto queue = m_groupCommit;
+    m_mutex.unlock();
+
+    return queue->enqueue(sql, binds);
+}
+
+GroupCommitStats Control::groupCommitStats(void)
+{
+    m_mutex.lock();
+    const auto queue = m_groupCommit;
+    m_mutex.unlock();
+
+    return queue ? queue->stats() : GroupCommitStats();
 }
 
-DatabaseSettings::DatabaseSettings(const QString &databaseType, const QString &connectionName, const QString &hostModeHostName, const QString &hostModeDatabaseName, const QString &hostModeUserName, const QString &hostModePassword):
-    DatabaseSettings(DatabaseHostMode, databaseType, connectionName)
+QList<SlowQueryStats> Control::slowQueryStats(void)
 {
-    m_hostModeHostName = hostModeHostName;
-    m_hostModeDatabaseName = hostModeDatabaseName;
-    m_hostModeUserName = hostModeUserName;
-    m_hostModePassword = hostModePassword;
+    return m_slowQueryLog ? m_slowQueryLog->stats() : QList<SlowQueryStats>();
 }
 
-// ConnectSettings
-ConnectSettings::ConnectSettings(const int &maxOpenTime, const QueryMode &queryMode, const int &minWaitTime)
+Cursor Control::cursor(const QString &sql, const QVariantList &binds, const int &chunkSize, const QueryPriority &priority)
 {
-    m_maxOpenTime = maxOpenTime;
-    m_queryMode = queryMode;
-    m_minWaitTime = minWaitTime;
+    // 不使用预编译语句缓存：forward-only须在prepare前设置，且游标长时间占用语句
+    auto query(readQuery(priority));
+
+    query->setForwardOnly(true);
+    auto ok = query->prepare(sql);
+    if(ok)
+    {
+        for(const auto &value: binds)
+        {
+            query->addBindValue(value);
+        }
+        ok = query.exec();
+    }
+
+    return Cursor(std::move(query), ok, (chunkSize > 0) ? chunkSize : m_connectSettings.cursorChunkSize());
 }
 
-// Query
-Query::Query(QSharedPointer<QSqlDatabase> dataBase, QSharedPointer<QMutex> mutex):
-    m_query(QSharedPointer<QSqlQuery>(new QSqlQuery(*dataBase))),
-    m_mutex(mutex),
-    m_database(dataBase)
+MetricsReport Control::metrics(void)
 {
+    MetricsReport report;
+    report.total.name = m_databaseSettings.connectionName();
+
+    forEachConnectNode([&report](ConnectNode *node)
+    {
+        const auto &&snapshot = node->metrics();
+        report.total += snapshot;
+        report.connections.append(snapshot);
+        report.statementCache += node->statementCacheStats();
+        report.openConnectionCount += node->isOpen() ? 1 : 0;
+    });
+    report.connectionCount = report.connections.size();
+
+    report.throttleWait = m_throttle->waitSnapshot();
+    report.breaker = m_breaker->stats();
+    report.groupCommit = groupCommitStats();
+    report.resultCache = resultCacheStats();
+    report.slowQueries = slowQueryStats().mid(0, 20);
+    if(m_pool)
+    {
+        report.poolWait = m_pool->waitSnapshot();
+        report.interactiveWait = m_pool->waitSnapshot(InteractivePriority);
+        report.backgroundWait = m_pool->waitSnapshot(BackgroundPriority);
+        report.pool = m_pool->stats();
+    }
 
+    return report;
 }
 
-Query::Query(Query &&other)
+int Control::connectionCount(void)
 {
-    swap(other);
+    int count = 0;
+    forEachConnectNode([&count](ConnectNode *) { count++; });
+    return count;
 }
 
-Query::~Query(void)
+int Control::openConnectionCount(void)
 {
-    if(m_mutex)
-    {
-        m_mutex->unlock();
-    }
+    int count = 0;
+    forEachConnectNode([&count](ConnectNode *node) { count += node->isOpen() ? 1 : 0; });
+    return count;
 }
 
-void Query::swap(Query &other)
+StatementCacheStats Control::statementCacheStats(void)
 {
-    m_query.swap(other.m_query);
-    m_mutex.swap(other.m_mutex);
+    StatementCacheStats stats;
+    forEachConnectNode([&stats](ConnectNode *node) { stats += node->statementCacheStats(); });
+    return stats;
 }
 
-// ConnectNode
-ConnectNode::ConnectNode(const DatabaseSettings &dataBaseSettings, const ConnectSettings &connectSettings):
-    m_dataBaseSettings(dataBaseSettings),
-    m_connectSettings(connectSettings)
+bool Control::isReadStatement(const QString &statement)
+{
+    static const QRegularExpression comment("^(\\s*(--[^\\n]*\\n|/\\*.*?\\*/|\\())*\\s*", QRegularExpression::DotMatchesEverythingOption);
+    static const QRegularExpression keyword("^(\\w+)");
+    static const QRegularExpression write("\\b(insert|update|delete|replace)\\b", QRegularExpression::CaseInsensitiveOption);
+
+    const auto &&body = statement.mid(comment.match(statement).capturedLength());
+    const auto &&first = keyword.match(body).captured(1).toLower();
+
+    if((first == "select") || (first == "values") || (first == "explain")) {
+        return true;
+    }
+    if(first == "with") {
+        return !write.match(body).hasMatch();
+    }
+    return false;
+}
+
+QString Control::fingerprint(const QString &statement)
 {
-    m_connectionName = QString("%1(%2)").arg(m_dataBaseSettings.connectionName()).arg(QString::number(qint64(QThread::currentThread()), 16));
+    static const QRegularExpression list("\\?(\\s*,\\s*\\?)+");
+    static const QRegularExpression rows("\\(\\?\\+?\\)(\\s*,\\s*\\(\\?\\+?\\))+");
 
-    m_mutex = QSharedPointer<QMutex>(new QMutex(QMutex::Recursive));
+    QString result;
+    result.reserve(statement.size());
 
-    if(m_connectSettings.maxOpenTime())
+    const auto &&size = statement.size();
+    for(int index = 0; index < size; )
     {
-        m_autoClose = QSharedPointer<QTimer>(new QTimer);
-        m_autoClose->setSingleShot(true);
-        m_autoClose->setInterval(m_connectSettings.maxOpenTime());
-        m_autoClose->moveToThread(qApp->thread());
-        m_autoClose->setParent(qApp);
+        const auto &&current = statement.at(index);
+
+        if(current == '\'')
+        {
+            // 字符串常量，''与反斜杠转义的引号不结束常量
+            for(index++; index < size; index++)
+            {
+                if(statement.at(index) == '\\')
+                {
+                    index++;
+                }
+                else if(statement.at(index) == '\'')
+                {
+                    if((index + 1 < size) && (statement.at(index + 1) == '\'')) {
+                        index++;
+                    } else {
+                        break;
+                    }
+                }
+            }
+            index++;
+            result += '?';
+        }
+        else if(current.isDigit() && (result.isEmpty() || !(result.at(result.size() - 1).isLetterOrNumber() || (result.at(result.size() - 1) == '_'))))
+        {
+            // 数字常量，包括小数、科学计数法与十六进制
+            while((index < size) && (statement.at(index).isLetterOrNumber() || (statement.at(index) == '.')))
+            {
+                index++;
+            }
+            result += '?';
+        }
+        else if(current.isSpace())
+        {
+            while((index < size) && statement.at(index).isSpace())
+            {
+                index++;
+            }
+            if(!result.isEmpty()) {
+                result += ' ';
+            }
+        }
+        else
+        {
+            result += current.toLower();
+            index++;
+        }
+    }
 
-        connect(m_autoClose.data(), SIGNAL(timeout()), this, SLOT(close()), Qt::DirectConnection);
-        connect(this, SIGNAL(startConnectionTiming()), m_autoClose.data(), SLOT(start()));
-        connect(this, SIGNAL(stopConnectionTiming()), m_autoClose.data(), SLOT(stop()));
+    if(result.endsWith(' ')) {
+        result.chop(1);
     }
 
-    createDataBase();
+    // 长度不同的in列表与多行values归为同一指纹
+    result.replace(list, "?+");
+    result.replace(rows, "(?+)+");
+    return result;
 }
 
-ConnectNode::~ConnectNode(void)
+PoolStats Control::poolStats(void) const
 {
-    m_autoClose->disconnect();
-    removeDataBase();
+    if(m_pool) {
+        return m_pool->stats();
+    }
+    return PoolStats();
 }
 
-Query ConnectNode::query(void)
+int Control::warmUp(void)
 {
-    if(!m_database) {
-        createDataBase();
-    }
+    const auto &&count = m_connectSettings.warmUpCount();
+    const auto &&statement = m_connectSettings.warmUpStatement();
 
-    if(!m_database->isOpen()) {
-        m_database->open();
-    }
+    switch(m_connectSettings.queryMode())
+    {
+    case QueryMultiMode: {
+        if(skipWarmUp(m_databaseSettings.databaseType())) { return 0; }
 
-    if(m_mutex){ m_mutex->lock(); }
+        m_registry->mutex.lock();
+        const auto &&create = qMax(0, count - m_registry->spare.size());
+        m_registry->mutex.unlock();
 
-    emit startConnectionTiming();
-    return Query(m_database, m_mutex);
-}
+        int succeeded = 0;
+        const auto &&node = openConnectNodes(create, m_databaseSettings, m_connectSettings, m_throttle, m_breaker, statement, &succeeded);
 
-bool ConnectNode::createDataBase(void)
-{
-    if(m_mutex) { m_mutex->lock(); }
+        m_registry->mutex.lock();
+        for(const auto &now: node)
+        {
+            QSharedPointer<ConnectNode> handle(now);
+            m_registry->node.append(handle);
+            m_registry->spare.append(handle);
+        }
+        m_registry->mutex.unlock();
 
-    if(m_database) {
-        removeDataBase();
+        return succeeded;
     }
+    case QueryPoolMode: {
+        if(skipWarmUp(m_databaseSettings.databaseType())) { return 0; }
 
-    if (!m_database) {
-        m_database = QSharedPointer<QSqlDatabase>(new QSqlDatabase(QSqlDatabase::addDatabase(m_dataBaseSettings.databaseType(), m_connectionName)));
+        return m_pool->warmUp(count, statement);
+    }
+    case QueryWalMode: {
+        // 写连接已在构造时打开，此处仅验证
+        return (singleConnectNode()->warmUp(statement) ? 1 : 0) + m_pool->warmUp(count, statement);
     }
+    default: {
+        return singleConnectNode()->warmUp(statement) ? 1 : 0;
+    }
+    }
+}
 
-    switch(m_dataBaseSettings.databaseMode())
+Query Control::acquire(const bool &read, const QString &preparedSql, const QueryPriority &priority, const QDeadlineTimer &deadline, const CancelToken &token)
+{
+    ConnectNode *node = nullptr;
+    ConnectPool *pool = nullptr;
+
+    switch(m_connectSettings.queryMode())
     {
-    case DatabaseNameMode: {
-        m_database->setDatabaseName(m_dataBaseSettings.nameModeName());
+    case QueryMultiMode: {
+        node = threadConnectNode();
         break;
     }
-    case DatabaseHostMode: {
-        m_database->setHostName(m_dataBaseSettings.hostModeHostName());
-        m_database->setDatabaseName(m_dataBaseSettings.hostModeDatabaseName());
-        m_database->setUserName(m_dataBaseSettings.hostModeUserName());
-        m_database->setPassword(m_dataBaseSettings.hostModePassword());
+    case QueryPoolMode: {
+        pool = m_pool.data();
         break;
     }
-    default:{
-        if(m_mutex){ m_mutex->unlock(); }
-        return false;
+    case QueryWalMode: {
+        if(read) {
+            pool = m_pool.data();
+        } else {
+            node = singleConnectNode();
+        }
+        break;
+    }
+    default: {
+        node = singleConnectNode();
+        break;
     }
     }
 
-    bool flag = open();
-    if(m_mutex){ m_mutex->unlock(); }
-    return flag;
+    // 优先级只作用于连接池，单连接与每线程连接不存在连接间的竞争
+    auto query(pool ? pool->query(preparedSql, priority, deadline, token) :
+                      (preparedSql.isEmpty() ? node->query(std::function<void(void)>(), deadline, token) : node->prepared(preparedSql, std::function<void(void)>(), deadline, token)));
+    query.m_resultCache = m_resultCache.data();
+    query.m_slowQueryLog = m_slowQueryLog.data();
+    return query;
 }
 
-void ConnectNode::removeDataBase(void)
+ConnectNode *Control::singleConnectNode(void)
 {
-    if(m_mutex){ m_mutex->lock(); }
-
-    QSqlDatabase::removeDatabase(m_connectionName);
+    // QuerySingleMode，以及QueryWalMode的写连接
+    m_mutex.lock();
+    if (!m_node) {
+        m_node = QSharedPointer<ConnectNode>(new ConnectNode(m_databaseSettings, m_connectSettings, m_throttle, m_breaker));
+    }
+    const auto &&node = m_node.data();
+    m_mutex.unlock();
 
-    if(m_mutex){ m_mutex->unlock(); }
+    return node;
 }
 
-bool ConnectNode::open(void)
+void Control::forEachConnectNode(const std::function<void(ConnectNode *)> &function)
 {
-    if(!m_database) {
-        createDataBase();
+    m_mutex.lock();
+    if(m_node) {
+        function(m_node.data());
     }
+    m_mutex.unlock();
 
-    if(m_mutex){ m_mutex->lock(); }
-
-    emit startConnectionTiming();
-    const bool flag = m_database->open();
+    if(m_pool) {
+        m_pool->forEach(function);
+    }
 
-    if(m_mutex){ m_mutex->unlock(); }
-    return flag;
+    m_registry->mutex.lock();
+    for(const auto &node: m_registry->node)
+    {
+        function(node.data());
+    }
+    m_registry->mutex.unlock();
 }
 
-void ConnectNode::close(void)
+ConnectNode *Control::threadConnectNode(void)
 {
-    if(m_mutex)
+    auto &cache = threadConnectCache;
+
+    for(auto &entry: cache.entry)
+    {
+        if((entry.controlId == m_id) && !entry.node->isDiscarded()) {
+            return entry.node.data();
+        }
+    }
+
+    // 首次查询或连接点已被废弃：注销废弃的连接点，清理已销毁Control遗留的句柄，并注册新的连接点
+    for(auto it = cache.entry.begin(); it != cache.entry.end();)
     {
-        if(m_mutex->tryLock())
+        if(it->controlId == m_id)
         {
-            m_mutex->unlock();
-            emit stopConnectionTiming();
-            if (m_database) {
-                m_database->close();
-            }
+            m_registry->remove(it->node);
+            it = cache.entry.erase(it);
+        }
+        else if(it->registry.isNull())
+        {
+            it = cache.entry.erase(it);
         }
         else
         {
-            emit startConnectionTiming();
+            ++it;
         }
     }
-    else
+
+    QSharedPointer<ConnectNode> node;
+
+    // 优先接管预热的备用连接点，首次查询不必等待连接握手
+    m_registry->mutex.lock();
+    if(!m_registry->spare.isEmpty()) {
+        node = m_registry->spare.takeLast();
+    }
+    m_registry->mutex.unlock();
+
+    if(!node)
     {
-        emit stopConnectionTiming();
-        if (m_database) {
-            m_database->close();
-        }
+        node = QSharedPointer<ConnectNode>(new ConnectNode(m_databaseSettings, m_connectSettings, m_throttle, m_breaker));
+
+        m_registry->mutex.lock();
+        m_registry->node.append(node);
+        m_registry->mutex.unlock();
     }
+
+    cache.entry.append({ m_id, node, m_registry });
+    return node.data();
 }
 
-// Control
-Control::Control(const DatabaseSettings &databaseSettings, const ConnectSettings &connectSettings):
-    m_databaseSettings(databaseSettings),
-    m_connectSettings(connectSettings),
-    hasMinWaitTime(false)
+// ReplicaControl
+ReplicaControl::ReplicaControl(const DatabaseSettings &primary, const QList<DatabaseSettings> &replicas, const ConnectSettings &connectSettings, const ReplicaPolicy &policy):
+    m_primary(new Control(primary, connectSettings)),
+    m_policy(policy)
 {
-    if(m_connectSettings.queryMode() == QueryAutoMode)
+    for(const auto &settings: replicas)
     {
-        if(databaseSettings.databaseType() == "QMYSQL") {
-            m_connectSettings.setQueryMode(QueryMultiMode);
-        } else if(databaseSettings.databaseType() == "QODBC") {
-            m_connectSettings.setQueryMode(QueryMultiMode);
-        } else {
-            m_connectSettings.setQueryMode(QuerySingleMode);
-        }
+        QSharedPointer<Replica> replica(new Replica);
+        replica->control = QSharedPointer<Control>(new Control(settings, connectSettings));
+        replica->name = settings.connectionName();
+        m_replica.append(replica);
     }
-    if(m_connectSettings.queryMode() == QuerySingleMode)
+}
+
+Query ReplicaControl::query(const QString &statement)
+{
+    return Control::isReadStatement(statement) ? acquireRead(QString()) : m_primary->writeQuery();
+}
+
+Query ReplicaControl::readQuery(void)
+{
+    return acquireRead(QString());
+}
+
+Query ReplicaControl::writeQuery(void)
+{
+    return m_primary->writeQuery();
+}
+
+Query ReplicaControl::prepared(const QString &sql)
+{
+    return Control::isReadStatement(sql) ? acquireRead(sql) : m_primary->prepared(sql);
+}
+
+ResultSet ReplicaControl::exec(const QString &sql, const QVariantList &binds)
+{
+    auto query(prepared(sql));
+
+    for(const auto &value: binds)
+    {
+        query->addBindValue(value);
+    }
+
+    return query.resultSet(query.exec());
+}
+
+BatchResult ReplicaControl::execBatch(const QString &sql, const QList<QVariantList> &columns, const int &chunkSize)
+{
+    return m_primary->execBatch(sql, columns, chunkSize);
+}
+
+void ReplicaControl::setSelector(const ReplicaSelector &selector)
+{
+    m_selector = selector;
+    m_policy = ReplicaCustomPolicy;
+}
+
+QVector<ReplicaStats> ReplicaControl::replicaStats(void) const
+{
+    QVector<ReplicaStats> stats;
+    for(int now = 0; now < m_replica.size(); now++)
     {
-        insertConnectNode(ThreadId(QThread::currentThread()));
+        stats.append(replicaStats(now));
     }
+    return stats;
+}
 
-    if(m_connectSettings.minWaitTime() == -1)
+Query ReplicaControl::acquireRead(const QString &preparedSql)
+{
+    // 熔断中的副本移出轮换，熔断时间结束后(HalfOpen)重新参与以试探恢复
+    QVector<int> candidate;
+    for(int now = 0; now < m_replica.size(); now++)
     {
-        if(databaseSettings.databaseType() == "QMYSQL") {
-            m_connectSettings.setMinWaitTime(0);
-        } else if(databaseSettings.databaseType() == "QODBC") {
-            m_connectSettings.setMinWaitTime(0);
-        } else {
-            m_connectSettings.setMinWaitTime(5);
-            hasMinWaitTime = true;
-            m_wait.start();
+        if(m_replica[now]->control->breakerState() != CircuitBreaker::Open) {
+            candidate.append(now);
         }
     }
-    else
+
+    while(!candidate.isEmpty())
     {
-        hasMinWaitTime = true;
-        m_wait.start();
+        const auto &&position = select(candidate);
+        const auto target = m_replica[candidate[position]].data();
+
+        auto query = preparedSql.isEmpty() ? target->control->readQuery() : target->control->prepared(preparedSql);
+        if(!query.isValid())
+        {
+            // 副本重连失败，尝试其他副本
+            candidate.remove(position);
+            continue;
+        }
+
+        target->outstanding.fetchAndAddRelaxed(1);
+        target->checkoutCount.fetchAndAddRelaxed(1);
+
+        // 以语句执行耗时而非租约持有时间计算延迟，调用者在租约内的处理时间不计入副本
+        query.m_execObserver = [target](const qint64 &sample)
+        {
+            // 指数加权平均，并发执行时允许丢失个别样本
+            const auto &&latency = target->latency.load();
+            target->latency.store(latency ? (latency + (sample - latency) / 8) : sample);
+        };
+
+        const auto release = query.m_release;
+        query.m_release = [release, target]()
+        {
+            if(release) {
+                release();
+            }
+
+            target->outstanding.fetchAndAddRelaxed(-1);
+        };
+
+        return query;
     }
+
+    // 所有副本不可用时读主库
+    return preparedSql.isEmpty() ? m_primary->readQuery() : m_primary->prepared(preparedSql);
 }
 
-Control::~Control(void)
+int ReplicaControl::select(const QVector<int> &candidate)
 {
-    destroyAllConnection();
+    const auto &&size = candidate.size();
+
+    switch(m_policy)
+    {
+    case ReplicaLeastOutstandingPolicy: {
+        // 从轮换位置开始比较，借出数相同时分散到不同副本
+        const auto &&start = quint32(m_next.fetchAndAddRelaxed(1));
+        int best = 0;
+        int bestOutstanding = -1;
+        for(int now = 0; now < size; now++)
+        {
+            const auto &&position = int((start + quint32(now)) % quint32(size));
+            const auto &&outstanding = m_replica[candidate[position]]->outstanding.load();
+            if((bestOutstanding < 0) || (outstanding < bestOutstanding))
+            {
+                best = position;
+                bestOutstanding = outstanding;
+            }
+        }
+        return best;
+    }
+    case ReplicaLatencyWeightedPolicy: {
+        // 尚无样本的副本按100us计，使其尽快获得样本
+        QVector<double> weight;
+        double total = 0;
+        for(const auto &index: candidate)
+        {
+            weight.append(1.0 / qMax<qint64>(100, m_replica[index]->latency.load()));
+            total += weight.last();
+        }
+
+        auto value = QRandomGenerator::global()->generateDouble() * total;
+        for(int now = 0; now < size; now++)
+        {
+            value -= weight[now];
+            if(value < 0) {
+                return now;
+            }
+        }
+        return size - 1;
+    }
+    case ReplicaCustomPolicy: {
+        if(m_selector)
+        {
+            QVector<ReplicaStats> stats;
+            for(const auto &index: candidate)
+            {
+                stats.append(replicaStats(index));
+            }
+
+            const auto &&position = m_selector(stats);
+            if((position >= 0) && (position < size)) {
+                return position;
+            }
+        }
+        break;
+    }
+    default: {
+        break;
+    }
+    }
+
+    return int(quint32(m_next.fetchAndAddRelaxed(1)) % quint32(size));
 }
 
-void Control::destroyAllConnection(void)
+ReplicaStats ReplicaControl::replicaStats(const int &index) const
 {
-    m_mutex.lock();
-
-    qDeleteAll(m_node) ;
-    m_node.clear();
+    const auto &replica = m_replica[index];
 
-    m_mutex.unlock();
+    ReplicaStats stats;
+    stats.name = replica->name;
+    stats.outstanding = replica->outstanding.load();
+    stats.latency = replica->latency.load();
+    stats.checkoutCount = replica->checkoutCount.load();
+    stats.available = replica->control->breakerState() != CircuitBreaker::Open;
+    return stats;
 }
 
-Query Control::query(void)
+// ShardControl
+ShardControl::ShardControl(const QList<DatabaseSettings> &shards, const ConnectSettings &connectSettings, const int &virtualNodeCount)
 {
-    wait();
+    Q_ASSERT(!shards.isEmpty());
 
-    const auto &&currentThread = qint64(QThread::currentThread());
-    if(m_connectSettings.queryMode() == QueryMultiMode)
+    for(int index = 0; index < shards.size(); index++)
     {
-        const auto &&now = m_node.find(currentThread);
-        if(now != m_node.end()) {
-            return Query((*now)->query());
-        } else {
-            m_mutex.lock();
-            insertConnectNode(currentThread);
-            m_mutex.unlock();
-            return query();
+        m_shard.append(QSharedPointer<Control>(new Control(shards[index], connectSettings)));
+
+        // 每次MD5产生4个虚拟节点，与ketama一致
+        for(int now = 0; now < qMax(1, virtualNodeCount / 4); now++)
+        {
+            const auto &&digest = QCryptographicHash::hash(QString("%1-%2").arg(shards[index].connectionName()).arg(now).toUtf8(), QCryptographicHash::Md5);
+            for(int part = 0; part < 4; part++)
+            {
+                m_ring.insert(ketamaPoint(digest, part), index);
+            }
         }
     }
-    else
+}
+
+int ShardControl::shardIndex(const QVariant &shardKey) const
+{
+    if(m_ring.isEmpty()) {
+        return -1;
+    }
+
+    const auto &&key = (shardKey.type() == QVariant::ByteArray) ? shardKey.toByteArray() : shardKey.toString().toUtf8();
+
+    // 顺时针找到第一个虚拟节点，超过最大值时回到环首
+    auto it = m_ring.lowerBound(hash(key));
+    if(it == m_ring.end()) {
+        it = m_ring.begin();
+    }
+    return it.value();
+}
+
+Query ShardControl::query(const QVariant &shardKey)
+{
+    const auto &&index = shardIndex(shardKey);
+    return (index < 0) ? Query() : m_shard[index]->query();
+}
+
+Query ShardControl::prepared(const QVariant &shardKey, const QString &sql)
+{
+    const auto &&index = shardIndex(shardKey);
+    return (index < 0) ? Query() : m_shard[index]->prepared(sql);
+}
+
+ResultSet ShardControl::exec(const QVariant &shardKey, const QString &sql, const QVariantList &binds)
+{
+    const auto &&index = shardIndex(shardKey);
+    if(index < 0)
     {
-        if (m_node.isEmpty()) {
-            insertConnectNode(currentThread);
-            return query();
-        }
-        return m_node.first()->query();
+        ResultSet result;
+        result.error = QSqlError("ShardControl::exec", "no shard available", QSqlError::ConnectionError);
+        return result;
     }
+
+    return m_shard[index]->exec(sql, binds);
 }
 
-void Control::insertConnectNode(const ThreadId &key)
+QList<ResultSet> ShardControl::scatter(const QString &sql, const QVariantList &binds)
 {
-    m_node.insert(key, new ConnectNode(m_databaseSettings, m_connectSettings));
+    QList<QFuture<ResultSet>> futures;
+    for(const auto &control: m_shard)
+    {
+        futures.append(control->execAsync(sql, binds));
+    }
+
+    QList<ResultSet> result;
+    for(auto &future: futures)
+    {
+        result.append(future.result());
+    }
+    return result;
 }
 
-void Control::wait()
+ResultSet ShardControl::scatterGather(const QString &sql, const QVariantList &binds)
 {
-    if(hasMinWaitTime)
+    ResultSet result;
+    result.ok = true;
+
+    for(const auto &now: scatter(sql, binds))
     {
-        const auto &&flag = m_connectSettings.minWaitTime() - m_wait.elapsed();
-        m_wait.restart();
-        if(flag > 0) {
-            QThread::msleep(flag);
+        if(!now.ok)
+        {
+            if(result.ok) {
+                result.error = now.error;
+            }
+            result.ok = false;
+            continue;
+        }
+
+        result.rows += now.rows;
+        if(now.numRowsAffected >= 0) {
+            result.numRowsAffected = qMax(0, result.numRowsAffected) + now.numRowsAffected;
         }
     }
+
+    return result;
+}
+
+quint32 ShardControl::hash(const QByteArray &data)
+{
+    return ketamaPoint(QCryptographicHash::hash(data, QCryptographicHash::Md5), 0);
 }
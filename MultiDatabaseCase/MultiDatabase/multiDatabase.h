@@ -3,6 +3,8 @@
 
 // C++ lib import
 #include <functional>
+#include <tuple>
+#include <type_traits>
 
 // Qt lib import
 #include <QtCore>
@@ -30,7 +32,24 @@ enum QueryMode
 {
     QueryAutoMode, // 根据配置的配置数据库驱动类型自动选择QueryMode，默认QMYSQL、QODBC类型使用 QueryMultiMode
     QueryMultiMode, // 推荐多线程query数据库的场景下使用
-    QuerySingleMode // 推荐仅主线程query数据库的场景下使用
+    QuerySingleMode, // 推荐仅主线程query数据库的场景下使用
+    QueryPoolMode, // 固定最小/最大连接数的连接池，推荐线程池等线程频繁创建、销毁的场景下使用
+    QueryWalMode // 仅QSQLITE，开启WAL日志，多个只读连接并行读、单个连接写，推荐读多写少的多线程场景下使用
+};
+
+enum QueryPriority
+{
+    InteractivePriority, // 面向用户的查询，可使用全部连接，等待时优先获得连接
+    BackgroundPriority, // 批量任务，只能使用部分连接，见ConnectSettings::laneBackgroundMaxCount
+    PriorityCount
+};
+
+enum ReplicaPolicy
+{
+    ReplicaRoundRobinPolicy, // 依次轮流使用各只读副本
+    ReplicaLeastOutstandingPolicy, // 使用当前借出Query最少的只读副本
+    ReplicaLatencyWeightedPolicy, // 按平均语句执行耗时的倒数加权随机选择只读副本
+    ReplicaCustomPolicy // 使用ReplicaControl::setSelector()设置的选择函数
 };
 
 class DatabaseSettings
@@ -50,6 +69,10 @@ private:
     PropertyDeclare(QString, hostModeUserName, setHostModeUserName)
     PropertyDeclare(QString, hostModePassword, setHostModePassword)
 
+    // Connect
+    PropertyDeclare(QString, connectOptions, setConnectOptions) // 驱动连接选项，如 QSQLITE_OPEN_READONLY
+    PropertyDeclare(QStringList, initStatements, setInitStatements) // 每次打开数据库后执行的语句，如 PRAGMA
+
     private:
         DatabaseSettings(const DatabaseModeEnum &databastMode, const QString &databaseType, const QString &connectionName);
 
@@ -63,7 +86,46 @@ public:
  * \brief The ConnectSettings class
  * maxOpenTime: 打开数据库最大时间, 默认打开数据库起60秒内未进行查询，就自动断开。避免打开数据库后长时间空置，造成资源浪费和意外断开
  * QueryMode：查询模式，默认为QueryAutoMode，推荐大型数据库如MySql使用QueryMultiMode，例如Sqlite的轻量级数据库使用QuerySingleMode，详见enum QueryMode
- * minWaitTime: 查询数据库最小等待时间(最小查询间隔)，比如Sqlite数据库，密集查询时可能出错，可控制最小查询间隔，如10ms
+ * minWaitTime: 兼容旧配置的最小查询间隔，大于0时换算为每秒 1000/minWaitTime 条语句的速率限制(rateLimit未设置时)，默认-1不限制
+ * rateLimit: 每个数据库每秒最多执行的语句数(令牌桶)，0表示不限制，默认0
+ * rateBurst: 令牌桶容量，即允许的突发语句数，默认1
+ * busyRetryCount: 驱动报告繁忙(如SQLITE_BUSY、锁等待超时)时Query::exec()的最大重试次数，默认5
+ * busyBackoffTime: 繁忙重试的初始退避时间，每次重试翻倍，默认2ms
+ * busyBackoffMaxTime: 繁忙重试的最大退避时间，默认200ms
+ * poolMinSize: QueryPoolMode下连接池的最小连接数，初始化时即创建，默认1
+ * poolMaxSize: QueryPoolMode下连接池的最大连接数，借出的连接数达到该值后，query()将等待其他Query归还连接，默认8
+ * poolWaitTime: QueryPoolMode下等待空闲连接的最长时间，超时后返回无效的Query(isValid()为false)，-1表示一直等待，默认30秒
+ * walReaderCount: QueryWalMode下只读连接的最大数量，默认为CPU核心数
+ * statementCacheSize: 每个连接点缓存的预编译语句数量(LRU)，供Control::prepared()复用，0表示不缓存，默认32
+ * batchChunkSize: Query::execBatch()每次execBatch绑定的行数，默认1000
+ * asyncThreadCount: Control::execAsync()专用执行线程数，0表示根据QueryMode自动选择(连接池大小，或CPU核心数)，默认0
+ * enableMetrics: 是否统计各连接点的锁等待、语句执行耗时等指标，见Control::metrics()，默认true
+ * warmUpCount: Control构造时并发预先打开的连接数，QueryMultiMode下为备用连接点，各线程首次查询时直接接管；QueryPoolMode、QueryWalMode下预先填充(只读)连接池，不超过池上限。预热的连接在临时线程中打开、由其他线程使用，仅对QSQLITE、QMYSQL(QMARIADB)、QPSQL生效，其他驱动(如QODBC)跳过预热，poolMinSize个连接在构造线程中依次打开，默认0
+ * warmUpStatement: 预热时在每个连接上执行的验证语句(如"SELECT 1")，为空时仅打开连接，默认为空
+ * warmUpInBackground: 是否在execAsync()的执行线程中后台预热，不阻塞Control构造，见Control::warmUpFuture()，默认false
+ * healthCheckIdleTime: 连接空置超过该时间后，借出前先执行healthCheckStatement检查连接是否可用，失效时自动重连，-1表示不检查，默认30秒
+ * healthCheckStatement: 健康检查语句，为空时使用"SELECT 1"，默认为空
+ * reconnectRetryCount: 借出时重连失败后的最大重试次数，默认2
+ * reconnectBackoffTime: 重连重试及熔断的初始退避时间，每次翻倍，默认100ms
+ * reconnectBackoffMaxTime: 重连重试及熔断的最大退避时间，默认10秒
+ * breakerThreshold: 连续连接失败达到该次数后熔断，熔断期间借出立即返回无效的Query，见CircuitBreaker，0表示不熔断，默认3
+ * cursorChunkSize: Cursor每次从驱动取出的行数，游标中最多保留一块(QMYSQL驱动仍缓存整个结果集，见Cursor)，默认1000
+ * groupCommitInterval: Control::enqueue()的组提交间隔，写线程取到第一条语句后最多等待该时间攒批，0表示写线程空闲时立即提交，默认5ms
+ * groupCommitBatchSize: 每次组提交的最大语句数，攒满时立即提交，默认1000
+ * groupCommitMaxPending: 队列中等待提交的最大语句数，超过时enqueue()阻塞等待，0表示不限制，默认100000
+ * groupCommitDurable: 为true时enqueue()返回的QFuture在事务提交后才完成；为false时入队即完成(ok为true)，之后执行失败的语句被丢弃，
+ *                     只能从GroupCommitStats的droppedCount、lastError得知，默认true
+ * resultCacheSize: 结果缓存的内存预算(字节，按字段值估算)，大于0时Control::exec()的读语句结果按语句与绑定参数缓存(LRU)，
+ *                  经同一Control的写语句自动使依赖相关表的缓存失效，见ResultCache，0表示不缓存，默认0
+ * laneReservedCount: 连接池中为InteractivePriority保留的连接数，BackgroundPriority的Query不能占用，默认1
+ * laneBackgroundMaxCount: BackgroundPriority最多同时占用的连接数，0表示poolMaxSize - laneReservedCount，至少为1，默认0
+ * laneAgingTime: BackgroundPriority等待超过该时间后与InteractivePriority同等优先，避免饥饿，-1表示不提升，默认1秒
+ *                优先级只在连接池(QueryPoolMode、QueryWalMode的只读连接)中生效
+ * slowQueryThreshold: 慢查询阈值，毫秒，执行时间不小于该值的语句按指纹汇总并写入慢查询日志，-1表示不记录，默认-1
+ * slowQuerySampleRate: 未超过阈值的语句按该比例抽样记录，0表示不抽样，默认0
+ * slowQueryLogPath: 慢查询日志文件，每行一条JSON，由后台线程写入，为空时只汇总不写文件，默认为空
+ * slowQueryLogMaxSize: 日志文件超过该大小(字节)后轮转为path.1、path.2...，默认16MB
+ * slowQueryLogMaxFiles: 保留的轮转文件数，默认5
  */
 class ConnectSettings
 {
@@ -72,139 +134,1741 @@ private:
     PropertyDeclare(QueryMode, queryMode, setQueryMode)
     PropertyDeclare(int, minWaitTime, setMinWaitTime)
 
+    // Throttle
+    PropertyDeclare(int, rateLimit, setRateLimit)
+    PropertyDeclare(int, rateBurst, setRateBurst)
+    PropertyDeclare(int, busyRetryCount, setBusyRetryCount)
+    PropertyDeclare(int, busyBackoffTime, setBusyBackoffTime)
+    PropertyDeclare(int, busyBackoffMaxTime, setBusyBackoffMaxTime)
+
+    // Pool mode
+    PropertyDeclare(int, poolMinSize, setPoolMinSize)
+    PropertyDeclare(int, poolMaxSize, setPoolMaxSize)
+    PropertyDeclare(int, poolWaitTime, setPoolWaitTime)
+
+    // Wal mode
+    PropertyDeclare(int, walReaderCount, setWalReaderCount)
+
+    // Statement cache
+    PropertyDeclare(int, statementCacheSize, setStatementCacheSize)
+
+    // Batch
+    PropertyDeclare(int, batchChunkSize, setBatchChunkSize)
+
+    // Async
+    PropertyDeclare(int, asyncThreadCount, setAsyncThreadCount)
+
+    // Metrics
+    PropertyDeclare(bool, enableMetrics, setEnableMetrics)
+
+    // Warm up
+    PropertyDeclare(int, warmUpCount, setWarmUpCount)
+    PropertyDeclare(QString, warmUpStatement, setWarmUpStatement)
+    PropertyDeclare(bool, warmUpInBackground, setWarmUpInBackground)
+
+    // Health check
+    PropertyDeclare(int, healthCheckIdleTime, setHealthCheckIdleTime)
+    PropertyDeclare(QString, healthCheckStatement, setHealthCheckStatement)
+    PropertyDeclare(int, reconnectRetryCount, setReconnectRetryCount)
+    PropertyDeclare(int, reconnectBackoffTime, setReconnectBackoffTime)
+    PropertyDeclare(int, reconnectBackoffMaxTime, setReconnectBackoffMaxTime)
+    PropertyDeclare(int, breakerThreshold, setBreakerThreshold)
+
+    // Cursor
+    PropertyDeclare(int, cursorChunkSize, setCursorChunkSize)
+
+    // Group commit
+    PropertyDeclare(int, groupCommitInterval, setGroupCommitInterval)
+    PropertyDeclare(int, groupCommitBatchSize, setGroupCommitBatchSize)
+    PropertyDeclare(int, groupCommitMaxPending, setGroupCommitMaxPending)
+    PropertyDeclare(bool, groupCommitDurable, setGroupCommitDurable)
+
+    // Result cache
+    PropertyDeclare(int, resultCacheSize, setResultCacheSize)
+
+    // Priority lane
+    PropertyDeclare(int, laneReservedCount, setLaneReservedCount)
+    PropertyDeclare(int, laneBackgroundMaxCount, setLaneBackgroundMaxCount)
+    PropertyDeclare(int, laneAgingTime, setLaneAgingTime)
+
+    // Slow query log
+    PropertyDeclare(int, slowQueryThreshold, setSlowQueryThreshold)
+    PropertyDeclare(double, slowQuerySampleRate, setSlowQuerySampleRate)
+    PropertyDeclare(QString, slowQueryLogPath, setSlowQueryLogPath)
+    PropertyDeclare(qint64, slowQueryLogMaxSize, setSlowQueryLogMaxSize)
+    PropertyDeclare(int, slowQueryLogMaxFiles, setSlowQueryLogMaxFiles)
+
     public:
         ConnectSettings(const int &maxOpenTime = 60 * 1000, const QueryMode &queryMode = QueryAutoMode, const int &minWaitTime = -1);
 };
 
 /*!
- * \brief The Query class
- * 对 QSqlQuery 的薄封装，以提供线程安全。
+ * \brief The BulkLoadSettings class
+ * Control::bulkLoad()的导入参数。
+ * table: 目标表
+ * columns: 文件中各字段对应的列名，顺序与文件一致
+ * delimiter: 字段分隔符，默认','，TSV使用'\t'
+ * quote: 引号，引号内可包含分隔符与换行，连续两个引号表示一个引号，'\0'表示不使用引号，默认'"'
+ * skipHeader: 是否跳过首行表头，默认false
+ * rowsPerStatement: 每条多行insert语句的行数，0表示按驱动的占位符上限自动选择(最多1000行)，默认0
+ * loadDataLocal: QMYSQL下使用LOAD DATA LOCAL INFILE由服务端读取文件，失败时回退到多行insert，
+ *                连接选项须包含MYSQL_OPT_LOCAL_INFILE=1且服务端开启local_infile，默认true
+ * progressInterval: 进度回调的最小间隔，毫秒，默认500
  */
-class Query
+class BulkLoadSettings
 {
 private:
-    QSharedPointer<QSqlQuery> m_query;
-    QSharedPointer<QMutex> m_mutex;
-    QSharedPointer<QSqlDatabase> m_database;
+    PropertyDeclare(QString, table, setTable)
+    PropertyDeclare(QStringList, columns, setColumns)
+    PropertyDeclare(char, delimiter, setDelimiter)
+    PropertyDeclare(char, quote, setQuote)
+    PropertyDeclare(bool, skipHeader, setSkipHeader)
+    PropertyDeclare(int, rowsPerStatement, setRowsPerStatement)
+    PropertyDeclare(bool, loadDataLocal, setLoadDataLocal)
+    PropertyDeclare(int, progressInterval, setProgressInterval)
 
 public:
+    BulkLoadSettings(const QString &table, const QStringList &columns, const char &delimiter = ',');
+};
+
+/*!
+ * \brief The LatencySnapshot class
+ * LatencyHistogram的快照，单位微秒，可累加以汇总多个连接点。
+ */
+struct LatencySnapshot
+{
+    qint64 count = 0;
+    qint64 total = 0;
+    qint64 max = 0;
+    QVector<qint64> buckets;
+
     /*!
-     * \brief Query
-     * 内部资源使用swap技术，以提高资源利用效率。
-     * \param other
+     * \brief percentile 百分位数，返回所在桶的上界
+     * \param value 百分比，如99.9
      */
-    Query(Query &&other);
+    qint64 percentile(const double &value) const;
 
-    ~Query(void);
+    inline qint64 average(void) const { return count ? (total / count) : 0; }
 
-    inline QSharedPointer<QSqlQuery> operator->(void) { return m_query; }
+    LatencySnapshot &operator+=(const LatencySnapshot &other);
 
-    inline QSqlQuery &operator*(void) { return *m_query; }
+    QJsonObject toJson(void) const;
 
-    void swap(Query &other);
+    QString toText(void) const;
+};
+
+/*!
+ * \brief The LatencyHistogram class
+ * HDR风格的对数线性直方图，单位微秒。每个2的幂区间再均分为SubBucketCount个子桶，相对误差不超过12.5%。
+ * 记录只需常数次无锁原子操作，可在任意线程中并发记录。
+ */
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        SubBucketBits = 3,
+        SubBucketCount = 1 << SubBucketBits,
+        BucketCount = (64 - SubBucketBits + 1) * SubBucketCount
+    };
 
 private:
-    Query(QSharedPointer<QSqlDatabase> dataBase, QSharedPointer<QMutex> mutex);
+    QAtomicInteger<qint64> m_bucket[BucketCount];
+    QAtomicInteger<qint64> m_count;
+    QAtomicInteger<qint64> m_total;
+    QAtomicInteger<qint64> m_max;
 
-    friend class Query;
-    friend class ConnectNode;
+public:
+    LatencyHistogram(void) = default;
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+
+    void record(const qint64 &value);
+
+    LatencySnapshot snapshot(void) const;
+
+    static int bucketIndex(const qint64 &value);
+
+    static qint64 bucketUpperBound(const int &index);
 };
 
 /*!
- * \brief The ConnectNode class
- * 线程为单位的与数据库的连接点。
- * 提供超时关闭数据库的功能。
+ * \brief The ConnectMetrics class
+ * 连接点的统计指标，由连接点持有，在连接点及其Query中记录。
  */
-class ConnectNode: public QObject
+class ConnectMetrics
 {
-    Q_OBJECT
+public:
+    LatencyHistogram lockWait; // 发生竞争时等待连接点的时间，无竞争的占用不记录
+    LatencyHistogram exec; // 语句执行时间(含繁忙重试)
+    QAtomicInteger<qint64> execErrorCount;
+    QAtomicInteger<qint64> busyRetryCount;
+    QAtomicInteger<qint64> createCount; // createDataBase()次数，首次之后即为重连
+    QAtomicInteger<qint64> openCount;
+    QAtomicInteger<qint64> openErrorCount;
+    QAtomicInteger<qint64> healthCheckCount;
+    QAtomicInteger<qint64> healthCheckErrorCount; // 健康检查发现连接失效的次数
+    QAtomicInteger<qint64> abortCount; // 因截止时间或取消未执行、被中断的语句数
+};
+
+/*!
+ * \brief The MetricsSnapshot class
+ * 单个连接点，或多个连接点汇总的指标快照。
+ */
+struct MetricsSnapshot
+{
+    QString name;
+    LatencySnapshot lockWait;
+    LatencySnapshot exec;
+    qint64 execErrorCount = 0;
+    qint64 busyRetryCount = 0;
+    qint64 createCount = 0;
+    qint64 openCount = 0;
+    qint64 openErrorCount = 0;
+    qint64 healthCheckCount = 0;
+    qint64 healthCheckErrorCount = 0;
+    qint64 abortCount = 0;
 
+    MetricsSnapshot &operator+=(const MetricsSnapshot &other);
+
+    QJsonObject toJson(void) const;
+
+    QString toText(void) const;
+};
+
+/*!
+ * \brief The Throttle class
+ * 以数据库为单位的限流器，由同一Control的所有连接点共享。
+ * 令牌桶限制语句速率，rateLimit为0时不限制，无竞争时不产生任何等待。
+ * 驱动报告繁忙时按指数退避后重试语句，同时提高共享的退避压力，使其他线程的新语句一同放缓；语句成功后压力逐步衰减。
+ */
+class Throttle
+{
 private:
-    QSharedPointer<QSqlDatabase> m_database;
-    QString m_connectionName;
+    const bool m_sqlite;
+    const double m_rate; // 每毫秒令牌数
+    const double m_burst;
+    const int m_retryCount;
+    const int m_backoffTime;
+    const int m_backoffMaxTime;
 
-    DatabaseSettings m_dataBaseSettings;
-    ConnectSettings m_connectSettings;
+    QMutex m_mutex;
+    QElapsedTimer m_clock;
+    double m_tokens;
+    qint64 m_last; // 上次补充令牌的时间，微秒
 
-    QSharedPointer<QTimer> m_autoClose;
-    QSharedPointer<QMutex> m_mutex;
+    QAtomicInt m_pressure; // 共享的退避压力，毫秒
+
+    LatencyHistogram m_wait;
 
 public:
+    Throttle(const QString &databaseType, const ConnectSettings &connectSettings);
+
+    Throttle(const Throttle &) = delete;
+
     /*!
-     * \brief ConnectNode 根据指定的数据库设置和连接设置(默认自动模式)的配置数据库和连接点
-     * \param dataBaseSettings 数据库设置
-     * \param connectSettings 连接设置
+     * \brief acquire 执行语句前获取令牌，令牌不足或存在退避压力时等待
      */
-    ConnectNode(const DatabaseSettings &dataBaseSettings, const ConnectSettings &connectSettings);
+    void acquire(void);
 
-    ~ConnectNode(void);
+    /*!
+     * \brief retry 语句失败后判断是否重试，繁忙错误且未超过重试次数时退避等待并返回true
+     * \param error 语句错误
+     * \param attempt 已重试次数
+     */
+    bool retry(const QSqlError &error, const int &attempt);
 
-    Query query(void);
+    /*!
+     * \brief success 语句成功后衰减退避压力
+     */
+    void success(void);
 
-signals:
-    void startConnectionTiming(void);
+    bool isBusyError(const QSqlError &error) const;
 
-    void stopConnectionTiming(void);
+    /*!
+     * \brief waitSnapshot 令牌桶及退避压力造成的等待时间，不含繁忙重试的退避
+     */
+    inline LatencySnapshot waitSnapshot(void) const { return m_wait.snapshot(); }
+};
 
-public slots:
-    bool createDataBase(void);
+/*!
+ * \brief The CircuitBreakerStats class
+ * 熔断器的状态与统计。
+ */
+struct CircuitBreakerStats
+{
+    int state = 0; // CircuitBreaker::State
+    int failureCount = 0; // 当前连续连接失败次数
+    qint64 tripCount = 0; // 熔断次数
+    qint64 rejectCount = 0; // 熔断期间被拒绝的连接请求数
+};
 
-    void removeDataBase(void);
+/*!
+ * \brief The CircuitBreaker class
+ * 以数据库为单位的熔断器，由同一Control的所有连接点共享，只统计建立连接的结果。
+ * 连续breakerThreshold次连接失败后熔断(Open)，熔断期间的连接请求立即失败，调用者不必各自等待连接超时；
+ * 熔断时间从reconnectBackoffTime起每次熔断翻倍，不超过reconnectBackoffMaxTime。
+ * 熔断时间结束后进入半开(HalfOpen)，只放行一个连接请求试探，成功则恢复(Closed)，失败则再次熔断。
+ */
+class CircuitBreaker
+{
+public:
+    enum State
+    {
+        Closed,
+        Open,
+        HalfOpen
+    };
 
-    bool open(void);
+private:
+    const int m_threshold;
+    const int m_backoffTime;
+    const int m_backoffMaxTime;
 
-    void close(void);
+    mutable QMutex m_mutex;
+    QElapsedTimer m_clock;
+    State m_state;
+    int m_failureCount;
+    int m_backoffCount; // 连续熔断次数，决定下次熔断时间
+    qint64 m_openUntil; // 毫秒
+    qint64 m_tripCount;
+
+    QAtomicInteger<qint64> m_rejectCount;
+
+public:
+    CircuitBreaker(const ConnectSettings &connectSettings);
+
+    CircuitBreaker(const CircuitBreaker &) = delete;
+
+    /*!
+     * \brief allow 建立连接前调用，熔断期间返回false；熔断时间结束后放行一个试探请求
+     */
+    bool allow(void);
+
+    void success(void);
 
+    void failure(void);
+
+    /*!
+     * \brief state 当前状态，熔断时间已结束但尚未试探时为HalfOpen
+     */
+    State state(void) const;
+
+    CircuitBreakerStats stats(void) const;
 };
 
-typedef qint64 ThreadId;
 /*!
- * \brief The Control class
- * 维护数据库信息
- * 维护Query对象在不同线程中对数据库的原子操作。
+ * \brief The PoolStats class
+ * 连接池的借出统计，等待时间单位为微秒。
  */
-class Control
+struct PoolStats
+{
+    qint64 checkoutCount = 0; // 成功借出次数
+    qint64 timeoutCount = 0; // 等待超时次数
+    qint64 waitCount = 0; // 需要等待其他Query归还连接的次数
+    qint64 totalWaitTime = 0;
+    qint64 maxWaitTime = 0;
+    int size = 0; // 当前连接数
+    int idleSize = 0; // 当前空闲连接数
+    int leasedSize[PriorityCount] = { 0, 0 }; // 各优先级当前借出的连接数
+    qint64 agedCount = 0; // BackgroundPriority等待超过laneAgingTime后被提升的次数
+
+    inline qint64 averageWaitTime(void) const { return (checkoutCount + timeoutCount) ? (totalWaitTime / (checkoutCount + timeoutCount)) : 0; }
+};
+
+/*!
+ * \brief The StatementCacheStats class
+ * 预编译语句缓存的命中统计。
+ */
+struct StatementCacheStats
+{
+    qint64 hitCount = 0;
+    qint64 missCount = 0;
+
+    inline double hitRate(void) const { return (hitCount + missCount) ? (double(hitCount) / (hitCount + missCount)) : 0; }
+
+    inline StatementCacheStats &operator+=(const StatementCacheStats &other) { hitCount += other.hitCount; missCount += other.missCount; return *this; }
+};
+
+/*!
+ * \brief The BatchResult class
+ * 批量执行的结果。失败时整批回滚，failedChunk、failedRow指出出错的分块与行(从0开始)，无法定位时为-1。
+ */
+struct BatchResult
+{
+    bool ok = true;
+    int chunkCount = 0; // 成功执行的分块数
+    qint64 rowCount = 0; // 成功执行的行数，失败回滚后为0
+    int failedChunk = -1;
+    qint64 failedRow = -1;
+    QSqlError error;
+};
+
+/*!
+ * \brief The ResultSet class
+ * 语句执行结果，select语句的所有行已取出，可在其他线程中使用。
+ */
+struct ResultSet
+{
+    bool ok = false;
+    QSqlError error;
+    QVector<QSqlRecord> rows;
+    int numRowsAffected = -1;
+    QVariant lastInsertId;
+};
+
+/*!
+ * \brief The BulkLoadProgress class
+ * Control::bulkLoad()的进度。
+ */
+struct BulkLoadProgress
+{
+    qint64 rowCount = 0; // 已执行(未提交)的行数
+    qint64 bytesRead = 0;
+    qint64 bytesTotal = 0;
+    qint64 elapsed = 0; // 毫秒
+
+    inline double rowsPerSecond(void) const { return elapsed ? (rowCount * 1000.0 / elapsed) : 0; }
+
+    inline double bytesPerSecond(void) const { return elapsed ? (bytesRead * 1000.0 / elapsed) : 0; }
+};
+
+/*!
+ * \brief The BulkLoadResult class
+ * Control::bulkLoad()的结果，失败时已回滚，rowCount为0。
+ */
+struct BulkLoadResult
+{
+    bool ok = true;
+    qint64 rowCount = 0;
+    qint64 failedRow = -1; // 出错的记录(不含表头，从0开始)，多行insert失败时为该语句的第一行
+    bool loadDataLocal = false; // 是否由LOAD DATA LOCAL INFILE导入
+    BulkLoadProgress progress; // 结束时的进度
+    QSqlError error;
+};
+
+/*!
+ * \brief The ResultCacheStats class
+ * 结果缓存的命中统计。
+ */
+struct ResultCacheStats
+{
+    qint64 hitCount = 0;
+    qint64 missCount = 0;
+    qint64 invalidateCount = 0; // 因写语句失效的缓存项数
+    int entryCount = 0;
+    int totalCost = 0; // 估算的字节数
+
+    inline double hitRate(void) const { return (hitCount + missCount) ? (double(hitCount) / (hitCount + missCount)) : 0; }
+};
+
+/*!
+ * \brief The ResultCache class
+ * 读语句结果缓存，以语句与绑定参数为键，按估算的字节数限制总大小，超出时淘汰最久未使用的项。
+ * 每项记录所依赖的表(由语句简单解析，或调用者显式指定)，写语句执行后使依赖被写表的项失效；
+ * 无法解析写语句涉及的表时清空整个缓存。每个表维护写入代数，读语句执行期间表被写入时不缓存其结果，避免缓存旧数据。
+ * 只能感知经同一Control执行的写语句，其他进程或连接的写入需调用invalidate()。
+ */
+class ResultCache
 {
 private:
-    DatabaseSettings m_databaseSettings;
-    ConnectSettings m_connectSettings;
-    QMap<ThreadId, ConnectNode *> m_node;
+    class Entry
+    {
+    public:
+        ResultSet result;
+        QStringList tables;
+        QByteArray key;
+        ResultCache *cache;
+
+        ~Entry(void);
+    };
 
     QMutex m_mutex;
-    QTime m_wait;
-    bool hasMinWaitTime;
+    QCache<QByteArray, Entry> m_cache;
+    QHash<QString, QSet<QByteArray>> m_dependency; // 表 -> 依赖该表的缓存项
+    QHash<QString, quint64> m_generation; // 表 -> 写入代数
+    quint64 m_globalGeneration = 0; // 清空整个缓存的次数
+
+    QAtomicInteger<qint64> m_hitCount;
+    QAtomicInteger<qint64> m_missCount;
+    QAtomicInteger<qint64> m_invalidateCount;
 
 public:
     /*!
-     * \brief Control 根据指定的数据库设置和连接设置(默认自动模式)的初始化控制器
-     * \param databaseSettings 数据库设置
-     * \param connectSettings 连接设置
+     * \brief ResultCache
+     * \param budget 内存预算，字节
      */
-    Control(const DatabaseSettings &databaseSettings, const ConnectSettings &connectSettings = ConnectSettings());
+    ResultCache(const int &budget);
 
-    Control(const Control &) = delete;
+    ResultCache(const ResultCache &) = delete;
 
-    Control(Control &&) = delete;
+    static QByteArray key(const QString &sql, const QVariantList &binds);
 
-    ~Control(void);
+    bool find(const QByteArray &key, ResultSet &result);
+
+    /*!
+     * \brief generation 表的写入代数之和，执行读语句前获取，insert()时用于判断执行期间表是否被写入
+     */
+    quint64 generation(const QStringList &tables);
+
+    void insert(const QByteArray &key, const ResultSet &result, const QStringList &tables, const quint64 &generation);
+
+    /*!
+     * \brief invalidate 使依赖指定表的缓存项失效，tables为空时清空整个缓存
+     */
+    void invalidate(const QStringList &tables);
+
+    ResultCacheStats stats(void);
+
+    /*!
+     * \brief readTables 解析读语句中from、join后的表名(小写，去掉库名与引号)，无法解析时为空
+     */
+    static QStringList readTables(const QString &sql);
+
+    /*!
+     * \brief writeTables 解析写语句(insert、replace、update、delete及DDL)涉及的表名，无法解析时为空
+     */
+    static QStringList writeTables(const QString &sql);
+
+private:
+    void unlink(const Entry &entry);
+};
+
+/*!
+ * \brief The TypedResultSet class
+ * Control::select()的执行结果，每行为std::tuple或调用者的结构体。
+ */
+template<typename Row>
+struct TypedResultSet
+{
+    bool ok = false;
+    QSqlError error;
+    QVector<Row> rows;
+};
+
+namespace typed_space
+{
+
+template<int... Index>
+struct IndexSequence { };
+
+template<int Count, int... Index>
+struct MakeIndexSequence: MakeIndexSequence<Count - 1, Count - 1, Index...> { };
+
+template<int... Index>
+struct MakeIndexSequence<0, Index...>
+{
+    typedef IndexSequence<Index...> Type;
+};
+
+/*!
+ * \brief The IsColumnType class
+ * 类型化接口支持的列类型
+ */
+template<typename T>
+struct IsColumnType
+{
+    enum
+    {
+        value = std::is_arithmetic<T>::value || std::is_same<T, QString>::value || std::is_same<T, QByteArray>::value ||
+                std::is_same<T, QDateTime>::value || std::is_same<T, QDate>::value || std::is_same<T, QTime>::value ||
+                std::is_same<T, QVariant>::value
+    };
+};
+
+template<typename... Ts>
+struct AllColumnTypes
+{
+    enum { value = true };
+};
+
+template<typename T, typename... Ts>
+struct AllColumnTypes<T, Ts...>
+{
+    enum { value = IsColumnType<T>::value && AllColumnTypes<Ts...>::value };
+};
+
+template<typename T>
+inline QVariant toVariant(const T &value) { return QVariant::fromValue(value); }
+
+inline QVariant toVariant(const char *value) { return QString(value); }
+
+inline void bindValues(QSqlQuery &) { }
+
+template<typename T, typename... Args>
+inline void bindValues(QSqlQuery &query, const T &value, const Args &... args)
+{
+    query.addBindValue(toVariant(value));
+    bindValues(query, args...);
+}
+
+/*!
+ * \brief readRow 按列下标直接取值构造行，不构造QSqlRecord
+ */
+template<typename Row, typename... Ts, int... Index>
+inline Row readRow(const QSqlQuery &query, IndexSequence<Index...>)
+{
+    return Row{ query.value(Index).template value<Ts>()... };
+}
+
+template<typename... Ts, int... Index>
+inline void appendRow(QList<QVariantList> &columns, const std::tuple<Ts...> &row, IndexSequence<Index...>)
+{
+    const int expand[] = { 0, (columns[Index].append(toVariant(std::get<Index>(row))), 0)... };
+    Q_UNUSED(expand);
+}
+
+}
+
+/*!
+ * \brief The CancelToken class
+ * 可在其他线程中取消的令牌，复制后共享同一状态。传给Control::query()等后，
+ * 取消时停止等待连接，并尽可能在驱动层中断正在执行的语句(见Query::isAborted())。
+ * 默认构造的令牌为空，永远不会被取消，使用create()创建可取消的令牌。
+ */
+class CancelToken
+{
+private:
+    struct State
+    {
+        QMutex mutex;
+        QWaitCondition finished; // 正在执行的回调返回时唤醒
+        QAtomicInt cancelled;
+        QMap<int, std::function<void(void)>> callback;
+        int serial = 0;
+        int running = -1; // 正在执行(不持有mutex)的回调序号
+    };
+
+    QSharedPointer<State> m_state;
 
 public:
+    static CancelToken create(void);
+
+    inline bool isNull(void) const { return m_state.isNull(); }
+
     /*!
-     * \brief destroyAllConnection 销毁所有与数据库的连接
+     * \brief cancel 取消，已订阅的回调在返回前执行完毕。回调在不持有令牌锁时逐个执行，慢回调(如KILL QUERY)不阻塞订阅与取消订阅
      */
-    void destroyAllConnection(void);
+    void cancel(void);
+
+    inline bool isCancelled(void) const { return m_state && m_state->cancelled.load(); }
 
+private:
     /*!
-     * \brief query 获得一个连接到数据库的Query对象。
-     * \return Query 对象
+     * \brief subscribe 订阅取消，订阅后调用者须再检查isCancelled()
+     * \return 订阅序号，用于unsubscribe()，令牌为空或已取消时不订阅并返回-1
+     */
+    int subscribe(const std::function<void(void)> &callback);
+
+    /*!
+     * \brief unsubscribe 取消订阅，正在执行的回调执行完毕后返回，保证返回后不再调用
      */
-    Query query(void);
+    void unsubscribe(const int &id);
+
+    friend class Query;
+    friend class ConnectNode;
+    friend class ConnectPool;
+};
 
+class SlowQueryLog;
+class ConnectNode;
+
+/*!
+ * \brief The ConnectLease class
+ * 对一个连接点的独占租约，只能移动不能复制，移动后原租约为空，析构或release()时归还，不会重复归还。
+ * 连接点记录的是租约的标识而不是线程，租约(及持有它的Query、Cursor)可以移动到其他线程中使用和归还。
+ * 需要占用连接点的ConnectNode私有函数以租约为参数，未取得租约时无法调用。
+ */
+class ConnectLease
+{
 private:
-    inline void insertConnectNode(const ThreadId &key);
+    ConnectNode *m_node = nullptr;
+    quint64 m_identity = 0;
+
+public:
+    ConnectLease(void) = default;
+
+    inline ConnectLease(ConnectLease &&other): m_node(other.m_node), m_identity(other.m_identity) { other.m_node = nullptr; other.m_identity = 0; }
+
+    inline ConnectLease &operator=(ConnectLease &&other) { if(this != &other) { release(); swap(other); } return *this; }
+
+    ConnectLease(const ConnectLease &) = delete;
+
+    ConnectLease &operator=(const ConnectLease &) = delete;
 
-    void wait();
+    inline ~ConnectLease(void) { release(); }
 
+    inline bool isValid(void) const { return m_node; }
+
+    /*!
+     * \brief release 提前归还连接点，租约为空时不做任何事
+     */
+    void release(void);
+
+    inline void swap(ConnectLease &other) { qSwap(m_node, other.m_node); qSwap(m_identity, other.m_identity); }
+
+    /*!
+     * \brief adopt 租约移交其他线程后改记为当前线程持有，原线程再次占用时不再视为嵌套
+     */
+    void adopt(void);
+
+private:
+    inline ConnectLease(ConnectNode *node, const quint64 &identity): m_node(node), m_identity(identity) { }
+
+    friend class ConnectNode;
+};
+
+/*!
+ * \brief The Query class
+ * 对 QSqlQuery 的薄封装，以提供线程安全。
+ * Query 持有连接点的租约，析构时归还，连接池模式下同时将连接归还连接池。
+ * 租约不可重入，见Control::query()。
+ */
+class Query
+{
+private:
+    QSharedPointer<QSqlQuery> m_query;
+    ConnectLease m_lease;
+    QSharedPointer<QSqlDatabase> m_database;
+    QSharedPointer<Throttle> m_throttle;
+    std::function<void(void)> m_release;
+    bool m_cached = false; // m_query来自连接点的预编译语句缓存，析构时finish()以释放语句占用的锁
+    ConnectMetrics *m_metrics = nullptr;
+    ResultCache *m_resultCache = nullptr; // 开启结果缓存时，写语句成功后使相关缓存失效
+    bool m_written = false;
+    QStringList m_writtenTables; // 为空且m_written时表示无法确定，析构时再次失效以覆盖事务提交前的读
+    QDeadlineTimer m_deadline = QDeadlineTimer(QDeadlineTimer::Forever);
+    CancelToken m_token;
+    std::function<void(void)> m_interrupt; // 在驱动层中断正在执行的语句，驱动不支持时为空
+    SlowQueryLog *m_slowQueryLog = nullptr;
+    std::function<void(const qint64 &)> m_execObserver; // 语句执行成功后以执行耗时(微秒)回调，ReplicaControl据此统计副本延迟
+
+public:
+    /*!
+     * \brief Query
+     * 内部资源使用swap技术，以提高资源利用效率。
+     * \param other
+     */
+    Query(Query &&other);
+
+    ~Query(void);
+
+    inline QSharedPointer<QSqlQuery> operator->(void) { return m_query; }
+
+    inline QSqlQuery &operator*(void) { return *m_query; }
+
+    /*!
+     * \brief isValid 是否持有数据库连接。连接池等待超时、熔断等情况下返回无效的Query，此时exec()、prepare()等总是失败，不会使用默认连接
+     */
+    inline bool isValid(void) const { return !m_database.isNull(); }
+
+    /*!
+     * \brief isAborted 是否已超过截止时间或被取消。此时exec()不再执行语句并返回false，执行中的语句尽可能被中断
+     */
+    inline bool isAborted(void) const { return m_deadline.hasExpired() || m_token.isCancelled(); }
+
+    /*!
+     * \brief transaction 在持有的连接上开启事务，驱动不支持事务或已在事务中时返回false
+     */
+    inline bool transaction(void) { return m_database && m_database->transaction(); }
+
+    inline bool commit(void) { return m_database && m_database->commit(); }
+
+    inline bool rollback(void) { return m_database && m_database->rollback(); }
+
+    /*!
+     * \brief lastDatabaseError 连接上最近的错误，如提交失败
+     */
+    inline QSqlError lastDatabaseError(void) const { return m_database ? m_database->lastError() : QSqlError(); }
+
+    /*!
+     * \brief exec 经过限流器执行已prepare的语句，驱动报告繁忙时退避后重试
+     * 直接调用 QSqlQuery::exec 不经过限流器
+     */
+    bool exec(void);
+
+    bool exec(const QString &sql);
+
+    /*!
+     * \brief execBatch 按列绑定并分块批量执行语句，整批在一个事务中提交，失败时回滚并定位出错的行
+     * 每个分块经过与exec()相同的截止时间、繁忙重试与慢查询日志；分块前设置保存点，出错时回到保存点只逐行重放该分块以定位出错的行，
+     * 数据库不支持SAVEPOINT时failedRow为-1。连接已处于调用者开启的事务中时，不另开事务也不提交，失败时不回滚也不定位出错的行
+     * \param sql 含占位符的语句
+     * \param columns 每个占位符一列，各列行数须相同
+     * \param chunkSize 每次execBatch绑定的行数
+     * \return 执行结果
+     */
+    BatchResult execBatch(const QString &sql, const QList<QVariantList> &columns, const int &chunkSize);
+
+    /*!
+     * \brief resultSet 取出已执行语句的所有行及执行信息
+     * \param ok 语句是否执行成功
+     */
+    ResultSet resultSet(const bool &ok);
+
+    void swap(Query &other);
+
+private:
+    Query(void);
+
+    Query(QSharedPointer<QSqlDatabase> dataBase, QSharedPointer<QSqlQuery> statement, ConnectLease &&lease, QSharedPointer<Throttle> throttle, ConnectMetrics *metrics, const std::function<void(void)> &release);
+
+    template<typename Function>
+    bool execute(const Function &function);
+
+    bool execChunk(const QList<QVariantList> &columns, const qint64 &offset, const qint64 &length);
+
+    qint64 locateFailedRow(const QList<QVariantList> &columns, const qint64 &offset, const qint64 &length);
+
+    /*!
+     * \brief invalidate 写语句执行成功后使结果缓存中相关的项失效
+     */
+    void invalidate(const QString &sql);
+
+    friend class Query;
+    friend class ConnectNode;
+    friend class ConnectPool;
+    friend class ReplicaControl;
+    friend class ShardControl;
+    friend class Control;
+};
+
+/*!
+ * \brief The Cursor class
+ * 只进的结果游标，QSqlQuery使用forward-only模式，按块从驱动取出行，游标自身最多保留一块：
+ * for(auto &row: cursor) { ... }
+ * 游标在读完或析构前一直占用连接。驱动层是否流式取决于驱动：QSQLITE逐行从数据库读取；
+ * QMYSQL无论是否使用绑定参数都会在exec()时把整个结果集缓存到客户端(mysql_store_result/mysql_stmt_store_result)，
+ * 此时游标只能减少QSqlRecord的构造与保留，不能限制内存，扫描大表应分页查询(如按主键范围)。
+ */
+class Cursor
+{
+public:
+    class iterator
+    {
+    private:
+        Cursor *m_cursor;
+
+    public:
+        inline iterator(Cursor *cursor): m_cursor(cursor) { }
+
+        inline QSqlRecord &operator*(void) const { return m_cursor->m_chunk[m_cursor->m_position]; }
+
+        inline QSqlRecord *operator->(void) const { return &m_cursor->m_chunk[m_cursor->m_position]; }
+
+        inline iterator &operator++(void) { if(!m_cursor->next()) { m_cursor = nullptr; } return *this; }
+
+        inline bool operator!=(const iterator &other) const { return m_cursor != other.m_cursor; }
+
+        inline bool operator==(const iterator &other) const { return m_cursor == other.m_cursor; }
+    };
+
+private:
+    QSharedPointer<Query> m_query; // 读完后释放，尽早归还连接
+    bool m_ok;
+    QSqlError m_error;
+    int m_chunkSize;
+
+    QVector<QSqlRecord> m_chunk;
+    int m_position = 0;
+    bool m_started = false;
+
+    qint64 m_rowCount = 0;
+    int m_peakRows = 0;
+    qint64 m_peakChunkMemory = 0;
+
+public:
+    Cursor(Cursor &&) = default;
+
+    /*!
+     * \brief isValid 语句是否执行成功
+     */
+    inline bool isValid(void) const { return m_ok; }
+
+    /*!
+     * \brief lastError 执行或取行时的错误
+     */
+    inline const QSqlError &lastError(void) const { return m_error; }
+
+    /*!
+     * \brief begin 取出第一块，游标只能遍历一次
+     */
+    iterator begin(void);
+
+    inline iterator end(void) { return iterator(nullptr); }
+
+    /*!
+     * \brief next 移动到下一行，当前块读完时取出下一块
+     * \return 是否还有行
+     */
+    bool next(void);
+
+    inline QSqlRecord &record(void) { return m_chunk[m_position]; }
+
+    /*!
+     * \brief rowCount 已取出的行数
+     */
+    inline qint64 rowCount(void) const { return m_rowCount; }
+
+    /*!
+     * \brief peakRows 内存中同时保留的最大行数
+     */
+    inline int peakRows(void) const { return m_peakRows; }
+
+    /*!
+     * \brief peakChunkMemory 游标的块中同时保留的行占用的最大字节数(按字段值估算)，不包括驱动缓存的结果集
+     */
+    inline qint64 peakChunkMemory(void) const { return m_peakChunkMemory; }
+
+    /*!
+     * \brief recordSize 按字段值估算一行占用的字节数
+     */
+    static qint64 recordSize(const QSqlRecord &record);
+
+private:
+    Cursor(Query &&query, const bool &ok, const int &chunkSize);
+
+    bool fetch(void);
+
+    friend class Control;
+};
+
+/*!
+ * \brief The ConnectNode class
+ * 线程为单位的与数据库的连接点。
+ * 提供超时关闭数据库的功能：每次使用时原子地记录时间，空置超过maxOpenTime的连接由后台回收线程统一关闭。
+ */
+class ConnectNode: public QObject
+{
+    Q_OBJECT
+
+private:
+    QSharedPointer<QSqlDatabase> m_database;
+    QString m_connectionName;
+
+    DatabaseSettings m_dataBaseSettings;
+    ConnectSettings m_connectSettings;
+    QSharedPointer<Throttle> m_throttle;
+    QSharedPointer<CircuitBreaker> m_breaker;
+
+    QAtomicInteger<qint64> m_lastUse; // 最后使用时间，毫秒，见ConnectReaper::now()
+    QAtomicInteger<quint64> m_owner; // 持有的租约的标识，为0时空闲
+    QAtomicInt m_waiterCount;
+    QMutex m_waitMutex; // 只在等待租约时使用
+    QWaitCondition m_waitCondition;
+    QAtomicInt m_discarded;
+
+    QSharedPointer<ConnectMetrics> m_metrics; // 未开启统计时为空
+
+    QAtomicInteger<qint64> m_serverThreadId; // QMYSQL连接在服务端的线程ID，用于KILL QUERY
+
+    QCache<QString, QSharedPointer<QSqlQuery>> m_statementCache;
+    QAtomicInteger<qint64> m_statementHit;
+    QAtomicInteger<qint64> m_statementMiss;
+
+public:
+    /*!
+     * \brief ConnectNode 根据指定的数据库设置和连接设置(默认自动模式)的配置数据库和连接点
+     * \param dataBaseSettings 数据库设置
+     * \param connectSettings 连接设置
+     * \param throttle 所属数据库的限流器，为空时不限流
+     * \param breaker 所属数据库的熔断器，为空时不熔断
+     */
+    ConnectNode(const DatabaseSettings &dataBaseSettings, const ConnectSettings &connectSettings, const QSharedPointer<Throttle> &throttle = QSharedPointer<Throttle>(), const QSharedPointer<CircuitBreaker> &breaker = QSharedPointer<CircuitBreaker>());
+
+    ~ConnectNode(void);
+
+    /*!
+     * \brief query 占用连接点并获得Query对象。连接空置超过healthCheckIdleTime时先检查连接，失效时重连
+     * \param release Query析构并释放连接点后调用，用于将连接点归还连接池
+     * \param deadline 截止时间，到期前未能占用连接点时放弃，Query的exec()也在到期后中断
+     * \param token 取消令牌
+     * \return Query 对象，连接不可用(重连失败或已熔断)或超时、取消时返回无效的Query，并已调用release
+     */
+    Query query(const std::function<void(void)> &release = std::function<void(void)>(), const QDeadlineTimer &deadline = QDeadlineTimer(QDeadlineTimer::Forever), const CancelToken &token = CancelToken());
+
+    /*!
+     * \brief prepared 占用连接点并获得已prepare指定语句的Query对象，语句从连接点的LRU缓存中复用
+     * \param sql 语句
+     * \param release 同query()
+     * \return Query 对象，绑定参数后调用exec()即可
+     */
+    Query prepared(const QString &sql, const std::function<void(void)> &release = std::function<void(void)>(), const QDeadlineTimer &deadline = QDeadlineTimer(QDeadlineTimer::Forever), const CancelToken &token = CancelToken());
+
+    StatementCacheStats statementCacheStats(void) const;
+
+    inline const QString &connectionName(void) const { return m_connectionName; }
+
+    /*!
+     * \brief metrics 连接点的指标快照，未开启统计时只有连接名
+     */
+    MetricsSnapshot metrics(void) const;
+
+    /*!
+     * \brief discard 等待正在使用的Query释放后关闭连接，并标记为废弃，持有该连接点的线程下次查询时将重新注册连接点
+     */
+    void discard(void);
+
+    inline bool isDiscarded(void) const { return m_discarded.load(); }
+
+    /*!
+     * \brief closeIfIdle 连接空置超过maxOpenTime且未被占用时关闭连接
+     * \param now 当前时间，见ConnectReaper::now()
+     * \return 是否关闭了连接
+     */
+    bool closeIfIdle(const qint64 &now);
+
+    inline int maxOpenTime(void) const { return m_connectSettings.maxOpenTime(); }
+
+    /*!
+     * \brief isOpen 连接是否打开，正被Query占用时视为打开
+     */
+    bool isOpen(void);
+
+    /*!
+     * \brief warmUp 确保连接已打开，并执行验证语句
+     * \param statement 验证语句，为空时仅打开连接
+     * \return 连接是否可用
+     */
+    bool warmUp(const QString &statement);
+
+    /*!
+     * \brief lease 占用连接点，空闲时只需一次原子操作，需要等待时(开启统计)记录等待时间
+     * 租约不可重入：连接点被本线程持有的租约占用时输出警告并立即返回空租约，不等待；
+     * 移交其他线程的租约在该线程首次执行语句时改记(见ConnectLease::adopt())，此前仍视为本线程持有
+     * \return 到期或取消前未能占用、或嵌套占用时返回空租约
+     */
+    ConnectLease lease(const QDeadlineTimer &deadline = QDeadlineTimer(QDeadlineTimer::Forever), const CancelToken &token = CancelToken());
+
+    /*!
+     * \brief tryLease 不等待地占用连接点，连接点正被占用时返回空租约
+     */
+    ConnectLease tryLease(void);
+
+public slots:
+    bool createDataBase(void);
+
+    void removeDataBase(void);
+
+    bool open(void);
+
+    void close(void);
+
+private:
+    /*!
+     * \brief unlease 归还连接点并唤醒一个等待者，只由ConnectLease调用
+     */
+    void unlease(const quint64 &identity);
+
+    bool createDataBase(const ConnectLease &lease);
+
+    void removeDataBase(const ConnectLease &lease);
+
+    bool open(const ConnectLease &lease);
+
+    /*!
+     * \brief arm 设置Query的截止时间与取消令牌，两者之一有效时附加中断函数
+     */
+    void arm(Query &query, const QDeadlineTimer &deadline, const CancelToken &token);
+
+    /*!
+     * \brief interrupter 在其他线程中中断当前语句的函数：QSQLITE使用sqlite3_interrupt()(需定义MULTIDATABASE_SQLITE_INTERRUPT)，
+     * QMYSQL另开连接执行KILL QUERY，其他驱动返回空函数
+     */
+    std::function<void(void)> interrupter(void) const;
+
+    void touch(void);
+
+    /*!
+     * \brief check 借出前确保连接可用
+     */
+    bool check(const ConnectLease &lease);
+
+    bool ping(void);
+
+    /*!
+     * \brief reconnect 按指数退避重连，熔断后立即放弃
+     */
+    bool reconnect(const ConnectLease &lease);
+
+    friend class ConnectLease;
+};
+
+/*!
+ * \brief The ConnectPool class
+ * QueryPoolMode使用的连接池，连接数限制在[poolMinSize, poolMaxSize]之间。
+ * query()借出一个空闲连接点，Query析构时归还；没有空闲连接点且已达上限时，最多等待poolWaitTime。
+ * 须由QSharedPointer管理：借出的Query持有连接池的引用，Query比Control存在更久时(如Cursor)仍可安全归还。
+ */
+class ConnectPool: public QEnableSharedFromThis<ConnectPool>
+{
+private:
+    DatabaseSettings m_databaseSettings;
+    ConnectSettings m_connectSettings;
+    QSharedPointer<Throttle> m_throttle;
+    QSharedPointer<CircuitBreaker> m_breaker;
+
+    QList<ConnectNode *> m_node;
+    QList<ConnectNode *> m_idleNode;
+    int m_size;
+    int m_creating = 0; // 已计入m_size、正在不持有锁时创建的连接点数
+
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    PoolStats m_stats;
+    LatencyHistogram m_wait;
+    LatencyHistogram m_laneWait[PriorityCount];
+
+    int m_backgroundMaxCount;
+    int m_leased[PriorityCount];
+    int m_waiting[PriorityCount]; // 各优先级正在等待的线程数，BackgroundPriority等待超时提升后计入InteractivePriority
+
+public:
+    ConnectPool(const DatabaseSettings &databaseSettings, const ConnectSettings &connectSettings, const QSharedPointer<Throttle> &throttle = QSharedPointer<Throttle>(), const QSharedPointer<CircuitBreaker> &breaker = QSharedPointer<CircuitBreaker>());
+
+    ConnectPool(const ConnectPool &) = delete;
+
+    ~ConnectPool(void);
+
+    /*!
+     * \brief query 借出一个连接点，等待超时则返回无效的Query
+     * 有InteractivePriority在等待时，BackgroundPriority让出空闲连接；BackgroundPriority占用的连接数不超过上限
+     * \param preparedSql 不为空时返回已prepare该语句的Query，见ConnectNode::prepared()
+     * \param priority 优先级
+     * \param deadline 截止时间，与poolWaitTime中较早者为止
+     * \param token 取消令牌，取消时立即停止等待
+     * \return Query 对象
+     */
+    Query query(const QString &preparedSql = QString(), const QueryPriority &priority = InteractivePriority, const QDeadlineTimer &deadline = QDeadlineTimer(QDeadlineTimer::Forever), const CancelToken &token = CancelToken());
+
+    /*!
+     * \brief destroyAllConnection 等待正在创建的连接点加入后，销毁所有空闲连接，正在借出的连接在归还时销毁
+     */
+    void destroyAllConnection(void);
+
+    PoolStats stats(void);
+
+    inline LatencySnapshot waitSnapshot(void) const { return m_wait.snapshot(); }
+
+    inline LatencySnapshot waitSnapshot(const QueryPriority &priority) const { return m_laneWait[priority].snapshot(); }
+
+    /*!
+     * \brief warmUp 并发创建连接点，使连接池至少有count个连接(不超过poolMaxSize)
+     * \param count 目标连接数
+     * \param statement 在新连接上执行的验证语句，为空时仅打开连接
+     * \return 新建且验证通过的连接数
+     */
+    int warmUp(const int &count, const QString &statement);
+
+    /*!
+     * \brief forEach 在持有连接池锁时遍历所有连接点
+     */
+    void forEach(const std::function<void(ConnectNode *)> &function);
+
+private:
+    void release(ConnectNode *node, const QueryPriority &priority);
+};
+
+class ConnectRegistry;
+
+class GroupCommitQueue;
+
+/*!
+ * \brief The GroupCommitStats class
+ * 组提交写队列的统计。
+ */
+struct GroupCommitStats
+{
+    qint64 flushCount = 0; // 提交的事务数
+    qint64 statementCount = 0; // 执行成功的语句数
+    qint64 errorCount = 0; // 执行失败的语句数
+    qint64 rollbackCount = 0; // 因语句或提交失败回滚重做的次数
+    qint64 droppedCount = 0; // groupCommitDurable为false时执行失败而丢弃的语句数
+    int pendingSize = 0; // 当前等待提交的语句数
+    QSqlError lastError; // 最近一条失败语句的错误
+    QString lastErrorFingerprint; // 最近一条失败语句的指纹，见Control::fingerprint()
+
+    inline double averageBatchSize(void) const { return flushCount ? (double(statementCount) / flushCount) : 0; }
+};
+
+/*!
+ * \brief The SlowQueryStats class
+ * 慢查询日志中一个语句指纹的汇总，包括超过阈值的语句与抽样记录的语句，时间单位为微秒。
+ */
+struct SlowQueryStats
+{
+    QString fingerprint;
+    QString sample; // 最近一次记录的原始语句
+    qint64 count = 0;
+    qint64 slowCount = 0; // 其中超过阈值的次数
+    qint64 errorCount = 0;
+    qint64 totalTime = 0;
+    qint64 maxTime = 0;
+
+    inline qint64 averageTime(void) const { return count ? (totalTime / count) : 0; }
+
+    QJsonObject toJson(void) const;
+};
+
+/*!
+ * \brief The MetricsReport class
+ * Control的指标报告：所有连接点的汇总、各连接点明细、限流等待与连接池借出等待。
+ */
+struct MetricsReport
+{
+    MetricsSnapshot total;
+    QList<MetricsSnapshot> connections;
+    LatencySnapshot throttleWait;
+    LatencySnapshot poolWait;
+    LatencySnapshot interactiveWait;
+    LatencySnapshot backgroundWait;
+    PoolStats pool;
+    StatementCacheStats statementCache;
+    CircuitBreakerStats breaker;
+    GroupCommitStats groupCommit;
+    ResultCacheStats resultCache;
+    QList<SlowQueryStats> slowQueries; // 总耗时最多的指纹，最多20个
+    int connectionCount = 0;
+    int openConnectionCount = 0;
+
+    QJsonObject toJson(void) const;
+
+    QString toText(void) const;
+};
+
+/*!
+ * \brief The Control class
+ * 维护数据库信息
+ * 维护Query对象在不同线程中对数据库的原子操作。
+ */
+class Control
+{
+private:
+    DatabaseSettings m_databaseSettings;
+    ConnectSettings m_connectSettings;
+    QSharedPointer<ConnectNode> m_node; // QuerySingleMode的连接点，QueryWalMode下为唯一的写连接点
+    QSharedPointer<ConnectPool> m_pool; // QueryPoolMode的连接池，QueryWalMode下为只读连接池
+
+    // QueryMultiMode下各线程的连接点，线程本地缓存持有连接点句柄，线程结束时自动注销并关闭，
+    // 连接点数不超过存活的查询线程数与备用连接点数之和
+    int m_id;
+    QSharedPointer<ConnectRegistry> m_registry;
+
+    QSharedPointer<Throttle> m_throttle;
+    QSharedPointer<CircuitBreaker> m_breaker;
+
+    QMutex m_mutex;
+
+    QThreadPool m_executor; // execAsync()专用执行线程，线程常驻并各自持有连接
+    QFuture<int> m_warmUp;
+
+    QSharedPointer<GroupCommitQueue> m_groupCommit; // enqueue()首次调用时创建
+    QSharedPointer<ResultCache> m_resultCache; // resultCacheSize大于0时创建
+    QSharedPointer<SlowQueryLog> m_slowQueryLog; // slowQueryThreshold不小于0时创建
+
+public:
+    /*!
+     * \brief Control 根据指定的数据库设置和连接设置(默认自动模式)的初始化控制器
+     * \param databaseSettings 数据库设置
+     * \param connectSettings 连接设置
+     */
+    Control(const DatabaseSettings &databaseSettings, const ConnectSettings &connectSettings = ConnectSettings());
+
+    Control(const Control &) = delete;
+
+    Control(Control &&) = delete;
+
+    ~Control(void);
+
+public:
+    /*!
+     * \brief destroyAllConnection 销毁所有与数据库的连接
+     */
+    void destroyAllConnection(void);
+
+    /*!
+     * \brief query 获得一个连接到数据库的Query对象。
+     * Query占用连接直到析构。QuerySingleMode、QueryMultiMode以及QueryWalMode的写语句中，同一线程共用一个连接，
+     * 在前一个Query(或Cursor)析构前再次取得Query时输出警告并返回无效的Query(isValid()为false)；需要嵌套查询时先取出结果，
+     * 或使用QueryPoolMode。Query可以移动到其他线程中使用和析构，在新线程中执行语句后原线程即可再次取得Query。
+     * \param priority 优先级，批量任务使用BackgroundPriority，见ConnectPool::query()
+     * \return Query 对象
+     */
+    Query query(const QueryPriority &priority = InteractivePriority);
+
+    /*!
+     * \brief query 根据语句类型获得Query对象，QueryWalMode下读语句使用只读连接，其他语句使用写连接
+     * \param statement 将要执行的语句
+     * \param priority 优先级
+     * \return Query 对象
+     */
+    Query query(const QString &statement, const QueryPriority &priority = InteractivePriority);
+
+    /*!
+     * \brief readQuery 获得用于只读语句的Query对象，QueryWalMode下从只读连接池借出，其他模式同query()
+     * \param priority 优先级
+     * \return Query 对象
+     */
+    Query readQuery(const QueryPriority &priority = InteractivePriority);
+
+    /*!
+     * \brief writeQuery 获得用于写语句的Query对象，QueryWalMode下使用唯一的写连接，其他模式同query()
+     * \param priority 优先级
+     * \return Query 对象
+     */
+    Query writeQuery(const QueryPriority &priority = InteractivePriority);
+
+    /*!
+     * \brief prepared 获得已prepare指定语句的Query对象，语句在各连接点中缓存复用，QueryWalMode下根据语句类型路由
+     * \param sql 语句
+     * \param priority 优先级
+     * \return Query 对象，绑定参数后调用exec()即可
+     */
+    Query prepared(const QString &sql, const QueryPriority &priority = InteractivePriority);
+
+    /*!
+     * \brief query 获得有截止时间的Query对象。截止时间同时限制等待连接(连接池或连接点的锁)与语句执行，
+     * 到期或取消前未能获得连接时返回无效的Query；执行中到期或取消时中断语句，exec()返回false，见Query::isAborted()
+     * 中断执行中的语句需驱动支持：QMYSQL使用KILL QUERY，QSQLITE需定义MULTIDATABASE_SQLITE_INTERRUPT(见.pro)，
+     * 其他情况下截止时间与取消只在执行前生效，首次使用时输出一次警告
+     * \param deadline 截止时间，如QDeadlineTimer(500)表示500毫秒后
+     * \param token 取消令牌，见CancelToken
+     * \param priority 优先级
+     * \return Query 对象
+     */
+    Query query(const QDeadlineTimer &deadline, const CancelToken &token = CancelToken(), const QueryPriority &priority = InteractivePriority);
+
+    Query query(const QString &statement, const QDeadlineTimer &deadline, const CancelToken &token = CancelToken(), const QueryPriority &priority = InteractivePriority);
+
+    Query prepared(const QString &sql, const QDeadlineTimer &deadline, const CancelToken &token = CancelToken(), const QueryPriority &priority = InteractivePriority);
+
+    /*!
+     * \brief execBatch 使用写连接按列批量执行语句，见Query::execBatch()
+     * \param sql 含占位符的语句
+     * \param columns 每个占位符一列
+     * \param chunkSize 每次execBatch绑定的行数，小于1时使用ConnectSettings::batchChunkSize
+     * \return 执行结果
+     */
+    BatchResult execBatch(const QString &sql, const QList<QVariantList> &columns, const int &chunkSize = -1);
+
+    /*!
+     * \brief exec 使用预编译语句缓存执行语句并取出所有结果，根据语句类型路由
+     * 开启结果缓存时，能解析出依赖表的读语句使用cached()
+     * \param sql 含占位符的语句
+     * \param binds 按顺序绑定的参数
+     * \return 执行结果
+     */
+    ResultSet exec(const QString &sql, const QVariantList &binds = QVariantList());
+
+    /*!
+     * \brief cached 从结果缓存中获取读语句的结果，未命中时执行并缓存，未开启结果缓存时同exec()
+     * \param sql 含占位符的读语句
+     * \param binds 按顺序绑定的参数
+     * \param tables 结果依赖的表(标签)，为空时从语句中解析，解析不出时不缓存
+     * \return 执行结果
+     */
+    ResultSet cached(const QString &sql, const QVariantList &binds = QVariantList(), const QStringList &tables = QStringList());
+
+    /*!
+     * \brief invalidate 使依赖指定表的缓存结果失效，用于其他进程或连接写入后，tables为空时清空结果缓存
+     */
+    void invalidate(const QStringList &tables = QStringList());
+
+    ResultCacheStats resultCacheStats(void);
+
+    /*!
+     * \brief execAsync 在专用执行线程中异步执行语句，调用线程不等待数据库
+     * \param sql 含占位符的语句
+     * \param binds 按顺序绑定的参数
+     * \return 执行结果，可通过QFutureWatcher在事件循环中获得
+     */
+    QFuture<ResultSet> execAsync(const QString &sql, const QVariantList &binds = QVariantList());
+
+    /*!
+     * \brief enqueue 将写语句放入组提交队列并立即返回，由单个写线程将队列中的多条语句合并到一个事务中提交，
+     * 以减少每条语句单独提交(Sqlite每次提交均需同步写盘)的开销。语句按入队顺序执行，单条语句失败时不影响同批其他语句
+     * \param sql 含占位符的写语句
+     * \param binds 按顺序绑定的参数
+     * \return 执行结果，groupCommitDurable为true时在事务提交后完成；为false时入队即报告成功，
+     * 之后执行失败的语句会被丢弃，见groupCommitStats()的droppedCount与lastError
+     */
+    QFuture<ResultSet> enqueue(const QString &sql, const QVariantList &binds = QVariantList());
+
+    GroupCommitStats groupCommitStats(void);
+
+    /*!
+     * \brief slowQueryStats 慢查询日志按指纹的汇总，按总耗时从多到少排序，未开启慢查询日志时为空。
+     * 最多保留1000个指纹，达到上限后新指纹的耗时超过最少的总耗时时淘汰该指纹(统计随之清零)，否则新指纹只写入日志不计入汇总
+     */
+    QList<SlowQueryStats> slowQueryStats(void);
+
+    /*!
+     * \brief cursor 执行只读语句并返回只进的流式游标，见Cursor
+     * \param sql 含占位符的语句
+     * \param binds 按顺序绑定的参数
+     * \param chunkSize 每次取出的行数，小于1时使用ConnectSettings::cursorChunkSize
+     * \param priority 优先级，导出等长时间扫描使用BackgroundPriority
+     * \return 游标，执行失败时isValid()为false
+     */
+    Cursor cursor(const QString &sql, const QVariantList &binds = QVariantList(), const int &chunkSize = -1, const QueryPriority &priority = InteractivePriority);
+
+    /*!
+     * \brief select 执行语句，按编译期给定的列类型逐列取值，每行为std::tuple<Ts...>，例：
+     * control.select<int, QString>("select id, name from User where age > ?", 18)
+     * 不支持的列类型编译失败；结果列数与Ts不一致时ok为false
+     * \param sql 含占位符的语句，使用预编译语句缓存并根据语句类型路由
+     * \param args 按顺序绑定的参数
+     * \return 执行结果
+     */
+    template<typename... Ts, typename... Args>
+    TypedResultSet<std::tuple<Ts...>> select(const QString &sql, const Args &... args);
+
+    /*!
+     * \brief selectAs 同select()，每行以Row{ Ts... }构造为调用者的结构体
+     */
+    template<typename Row, typename... Ts, typename... Args>
+    TypedResultSet<Row> selectAs(const QString &sql, const Args &... args);
+
+    /*!
+     * \brief insert 将std::tuple行按列展开后批量执行，见execBatch()
+     * \param sql 含占位符的语句，每个占位符对应tuple的一个元素
+     * \param rows 各行
+     * \param chunkSize 同execBatch()
+     * \return 执行结果
+     */
+    template<typename... Ts>
+    BatchResult insert(const QString &sql, const QVector<std::tuple<Ts...>> &rows, const int &chunkSize = -1);
+
+    /*!
+     * \brief bulkLoad 将CSV/TSV文件导入表中。文件以内存映射读取，字段在映射内存中解析，未加引号的整数直接转换为qint64绑定，
+     * \\N表示NULL，其余字段转换为QString；使用写连接(BackgroundPriority)在一个事务中以预编译的多行insert分块执行，失败或取消时回滚
+     * \param path 文件路径
+     * \param settings 导入参数，见BulkLoadSettings
+     * \param progress 进度回调，在调用线程中至多每progressInterval调用一次，结束时再调用一次
+     * \param token 取消令牌，在语句之间检查
+     * \return 导入结果
+     */
+    BulkLoadResult bulkLoad(const QString &path, const BulkLoadSettings &settings,
+                            const std::function<void(const BulkLoadProgress &)> &progress = std::function<void(const BulkLoadProgress &)>(),
+                            const CancelToken &token = CancelToken());
+
+    /*!
+     * \brief statementCacheStats 所有连接点的预编译语句缓存命中统计
+     */
+    StatementCacheStats statementCacheStats(void);
+
+    /*!
+     * \brief connectionCount 当前的连接点数，QueryMultiMode下线程结束后其连接点即被释放
+     */
+    int connectionCount(void);
+
+    /*!
+     * \brief openConnectionCount 当前打开的连接数，空置超过maxOpenTime的连接由回收线程关闭，再次查询时重新打开
+     */
+    int openConnectionCount(void);
+
+    /*!
+     * \brief metrics 指标报告，可通过toJson()、toText()输出
+     */
+    MetricsReport metrics(void);
+
+    /*!
+     * \brief isReadStatement 判断语句是否为只读语句(select、values、explain，及不含写操作的with)
+     */
+    static bool isReadStatement(const QString &statement);
+
+    /*!
+     * \brief fingerprint 语句指纹：字符串与数字常量替换为?，占位符列表与多行values合并为?+，空白合并，其余字符小写
+     * 如"SELECT * FROM t WHERE id IN (1, 2, 3)"的指纹为"select * from t where id in (?+)"
+     */
+    static QString fingerprint(const QString &statement);
+
+    /*!
+     * \brief poolStats 连接池的借出统计，仅QueryPoolMode下有效，QueryWalMode下为只读连接池的统计
+     * \return 统计数据
+     */
+    PoolStats poolStats(void) const;
+
+    /*!
+     * \brief breakerState 熔断器当前状态，熔断期间各查询立即返回无效的Query
+     */
+    inline CircuitBreaker::State breakerState(void) const { return m_breaker->state(); }
+
+    /*!
+     * \brief warmUp 按warmUpCount并发预先打开连接并执行warmUpStatement，Control构造时已自动调用
+     * \return 验证通过的连接数
+     */
+    int warmUp(void);
+
+    /*!
+     * \brief warmUpFuture 构造时预热的结果，warmUpInBackground为true时可等待预热完成
+     */
+    inline QFuture<int> warmUpFuture(void) const { return m_warmUp; }
+
+private:
+    /*!
+     * \brief threadConnectNode 获得当前线程的连接点，每个线程仅在首次查询时注册
+     */
+    ConnectNode *threadConnectNode(void);
+
+    ConnectNode *singleConnectNode(void);
+
+    Query acquire(const bool &read, const QString &preparedSql, const QueryPriority &priority, const QDeadlineTimer &deadline = QDeadlineTimer(QDeadlineTimer::Forever), const CancelToken &token = CancelToken());
+
+    ResultSet execute(const QString &sql, const QVariantList &binds);
+
+    /*!
+     * \brief forEachConnectNode 遍历当前所有模式下的连接点
+     */
+    void forEachConnectNode(const std::function<void(ConnectNode *)> &function);
+
+};
+
+template<typename... Ts, typename... Args>
+TypedResultSet<std::tuple<Ts...>> Control::select(const QString &sql, const Args &... args)
+{
+    return selectAs<std::tuple<Ts...>, Ts...>(sql, args...);
+}
+
+template<typename Row, typename... Ts, typename... Args>
+TypedResultSet<Row> Control::selectAs(const QString &sql, const Args &... args)
+{
+    static_assert(sizeof...(Ts) > 0, "Control::select: at least one column type is required");
+    static_assert(typed_space::AllColumnTypes<Ts...>::value, "Control::select: unsupported column type");
+
+    TypedResultSet<Row> result;
+
+    auto query(prepared(sql));
+    typed_space::bindValues(*query, args...);
+
+    result.ok = query.exec();
+    if(!result.ok)
+    {
+        result.error = query->lastError();
+        return result;
+    }
+
+    if(query->record().count() != int(sizeof...(Ts)))
+    {
+        result.ok = false;
+        result.error = QSqlError("Control::select", "column count mismatch", QSqlError::StatementError);
+        return result;
+    }
+
+    while(query->next())
+    {
+        result.rows.append(typed_space::readRow<Row, Ts...>(*query, typename typed_space::MakeIndexSequence<sizeof...(Ts)>::Type()));
+    }
+
+    return result;
+}
+
+template<typename... Ts>
+BatchResult Control::insert(const QString &sql, const QVector<std::tuple<Ts...>> &rows, const int &chunkSize)
+{
+    static_assert(sizeof...(Ts) > 0, "Control::insert: at least one column type is required");
+    static_assert(typed_space::AllColumnTypes<Ts...>::value, "Control::insert: unsupported column type");
+
+    QList<QVariantList> columns;
+    for(int now = 0; now < int(sizeof...(Ts)); now++)
+    {
+        columns.append(QVariantList());
+        columns.last().reserve(rows.size());
+    }
+
+    for(const auto &row: rows)
+    {
+        typed_space::appendRow(columns, row, typename typed_space::MakeIndexSequence<sizeof...(Ts)>::Type());
+    }
+
+    return execBatch(sql, columns, chunkSize);
+}
+
+/*!
+ * \brief The ReplicaStats class
+ * 只读副本的路由统计，latency为语句执行耗时(成功的exec/execBatch)的指数加权平均，单位微秒。
+ */
+struct ReplicaStats
+{
+    QString name;
+    int outstanding = 0; // 当前借出的Query数
+    qint64 latency = 0;
+    qint64 checkoutCount = 0;
+    bool available = true; // 熔断器未熔断
+};
+
+/*!
+ * \brief The ReplicaControl class
+ * 一个主库与多个只读副本。写语句及事务使用主库，读语句按ReplicaPolicy在可用的副本间路由。
+ * 副本的连接健康检查失败并熔断(见CircuitBreaker)后移出轮换，熔断时间结束后自动试探恢复；所有副本不可用时读主库。
+ * 副本之间的数据同步由数据库完成，需要读到刚写入的数据时使用writeQuery()。
+ * 本地测试时可用多个Sqlite文件代替副本。
+ */
+class ReplicaControl
+{
+public:
+    /*!
+     * \brief ReplicaSelector 自定义选择函数，参数为可用副本的统计，返回其中的下标
+     */
+    typedef std::function<int(const QVector<ReplicaStats> &)> ReplicaSelector;
+
+private:
+    class Replica
+    {
+    public:
+        QSharedPointer<Control> control;
+        QString name;
+        QAtomicInt outstanding;
+        QAtomicInteger<qint64> latency;
+        QAtomicInteger<qint64> checkoutCount;
+    };
+
+    QSharedPointer<Control> m_primary;
+    QList<QSharedPointer<Replica>> m_replica;
+
+    ReplicaPolicy m_policy;
+    ReplicaSelector m_selector;
+    QAtomicInt m_next;
+
+public:
+    /*!
+     * \brief ReplicaControl 根据主库与各副本的数据库设置初始化，各数据库的连接名须不同
+     * \param primary 主库设置
+     * \param replicas 只读副本设置，为空时所有语句使用主库
+     * \param connectSettings 连接设置，主库与副本共用
+     * \param policy 读语句的路由策略
+     */
+    ReplicaControl(const DatabaseSettings &primary, const QList<DatabaseSettings> &replicas, const ConnectSettings &connectSettings = ConnectSettings(), const ReplicaPolicy &policy = ReplicaRoundRobinPolicy);
+
+    ReplicaControl(const ReplicaControl &) = delete;
+
+    /*!
+     * \brief query 根据语句类型获得Query对象，读语句路由至副本，其他语句使用主库
+     */
+    Query query(const QString &statement);
+
+    /*!
+     * \brief readQuery 从副本获得Query对象，所有副本不可用时使用主库
+     */
+    Query readQuery(void);
+
+    /*!
+     * \brief writeQuery 获得主库的Query对象
+     */
+    Query writeQuery(void);
+
+    /*!
+     * \brief prepared 获得已prepare指定语句的Query对象，根据语句类型路由
+     */
+    Query prepared(const QString &sql);
+
+    /*!
+     * \brief exec 执行语句并取出所有结果，根据语句类型路由，见Control::exec()
+     */
+    ResultSet exec(const QString &sql, const QVariantList &binds = QVariantList());
+
+    /*!
+     * \brief execBatch 在主库上批量执行语句，见Control::execBatch()
+     */
+    BatchResult execBatch(const QString &sql, const QList<QVariantList> &columns, const int &chunkSize = -1);
+
+    inline Control &primary(void) { return *m_primary; }
+
+    inline int replicaCount(void) const { return m_replica.size(); }
+
+    inline Control &replica(const int &index) { return *m_replica[index]->control; }
+
+    inline ReplicaPolicy policy(void) const { return m_policy; }
+
+    /*!
+     * \brief setSelector 设置自定义选择函数，并切换为ReplicaCustomPolicy，须在开始查询前设置
+     */
+    void setSelector(const ReplicaSelector &selector);
+
+    QVector<ReplicaStats> replicaStats(void) const;
+
+private:
+    Query acquireRead(const QString &preparedSql);
+
+    /*!
+     * \brief select 按路由策略选择副本
+     * \param candidate 可用副本的下标
+     * \return candidate中的位置
+     */
+    int select(const QVector<int> &candidate);
+
+    ReplicaStats replicaStats(const int &index) const;
+};
+
+/*!
+ * \brief The ShardControl class
+ * 按分片键将数据分布到多个数据库，每个分片由一个Control管理连接。
+ * 分片键以一致性哈希(ketama，每个分片virtualNodeCount个虚拟节点)映射到分片，虚拟节点由分片的连接名生成，
+ * 增加或移除分片时只有约1/n的键改变归属；各分片的连接名须不同且保持稳定。
+ * scatter()在所有分片上并行执行同一语句，各分片在自己的execAsync()执行线程中执行。
+ */
+class ShardControl
+{
+private:
+    QList<QSharedPointer<Control>> m_shard;
+    QMap<quint32, int> m_ring; // 虚拟节点哈希 -> 分片下标
+
+public:
+    /*!
+     * \brief ShardControl 根据各分片的数据库设置初始化
+     * \param shards 各分片的数据库设置
+     * \param connectSettings 连接设置，各分片共用
+     * \param virtualNodeCount 每个分片在哈希环上的虚拟节点数，越多分布越均匀
+     */
+    ShardControl(const QList<DatabaseSettings> &shards, const ConnectSettings &connectSettings = ConnectSettings(), const int &virtualNodeCount = 160);
+
+    ShardControl(const ShardControl &) = delete;
+
+    /*!
+     * \brief shardIndex 分片键所属的分片，QByteArray按原样哈希，其他类型按toString()的UTF-8哈希，没有分片时返回-1
+     */
+    int shardIndex(const QVariant &shardKey) const;
+
+    inline int shardCount(void) const { return m_shard.size(); }
+
+    inline Control &shard(const int &index) { return *m_shard[index]; }
+
+    /*!
+     * \brief shard 分片键所属分片的Control，须至少有一个分片
+     */
+    inline Control &shard(const QVariant &shardKey) { Q_ASSERT(!m_shard.isEmpty()); return *m_shard[shardIndex(shardKey)]; }
+
+    /*!
+     * \brief query 获得分片键所属分片的Query对象，没有分片时返回无效的Query
+     */
+    Query query(const QVariant &shardKey);
+
+    /*!
+     * \brief prepared 获得分片键所属分片已prepare指定语句的Query对象，没有分片时返回无效的Query
+     */
+    Query prepared(const QVariant &shardKey, const QString &sql);
+
+    /*!
+     * \brief exec 在分片键所属分片上执行语句，见Control::exec()，没有分片时ok为false
+     */
+    ResultSet exec(const QVariant &shardKey, const QString &sql, const QVariantList &binds = QVariantList());
+
+    /*!
+     * \brief scatter 在所有分片上并行执行同一语句
+     * \return 各分片的执行结果，顺序与分片下标相同
+     */
+    QList<ResultSet> scatter(const QString &sql, const QVariantList &binds = QVariantList());
+
+    /*!
+     * \brief scatterGather 在所有分片上并行执行同一语句并合并结果：各分片的行按分片下标顺序拼接，影响行数求和，
+     * 任一分片失败时ok为false，error为第一个失败分片的错误。排序、聚合等需由调用者在合并后处理
+     */
+    ResultSet scatterGather(const QString &sql, const QVariantList &binds = QVariantList());
+
+    /*!
+     * \brief hash ketama哈希，取MD5的前4字节
+     */
+    static quint32 hash(const QByteArray &data);
 };
 
 } // multi_database_space
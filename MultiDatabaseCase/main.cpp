@@ -1,191 +1,558 @@
+// C++ lib import
+#include <random>
+
 // Qt lib import
 #include <QCoreApplication>
+#include <QCommandLineParser>
 #include <QtConcurrent>
 #include <QSqlError>
 
 // JasonQt lib import
 #include "multiDatabase/multiDatabase.h"
 
-int main(int argc, char *argv[])
+using namespace multi_database_space;
+
+/*
+ * 基准测试
+ * 以固定的随机种子、时长、线程数与读写比例压测数据库，按操作类型输出吞吐量与p50/p99/p999延迟(JSON或文本)，
+ * 用于在同一台机器、同一个数据库文件上比较调优前后的差异。
+ *
+ * 例：multiDatabase --mode wal --threads 8 --read-ratio 0.85 --rows 1280 --seed 1 --duration 10 --database ./test.db
+ * select操作取出所有结果行，默认以QSqlRecord(QVariant)取行，--typed时使用Control::select<Ts...>()按列类型直接取值，
+ * 两次运行的select延迟与rowCount之比即为每行开销的差异。
+ * --group-commit时insert、update、delete经Control::enqueue()组提交，并等待提交完成，与默认的逐条提交比较写吞吐量。
+ * --result-cache开启结果缓存(字节)，非--typed的select经缓存读取，写操作使缓存失效。
+ * --scan-threads另开线程以BackgroundPriority游标反复全表扫描Test2(scan)，--mode pool时观察select的p99是否受影响，
+ * --scan-priority interactive时扫描与select同等竞争连接，作为对照。
+ * --bulk-load时预置数据先写入CSV文件，再经Control::bulkLoad()导入，与默认的execBatch比较prepareElapsed。
+ * --slow-query开启慢查询日志(毫秒)，--slow-query-log指定日志文件，结果中metrics.slowQueries按指纹汇总耗时。
+ * --checkout只测量连接点的取得与归还：ConnectNode::lease()与重构前的QSharedPointer<QMutex>递归锁对比，
+ * 分别在单线程与--threads个线程竞争同一连接点时测量，使用默认设置(开启统计)，不预置数据也不执行语句。
+ *
+ * 注：关于连接方式
+ * Sqlite的连接方式                       类型        连接名      Sqlite文件路径   单次打开数据库最大时间        查询模式
+ * multi_database_space::Control control({ "QSQLITE", "TestDB", "./test.db" }, { 60 * 1000, multi_database_space::QuerySingleMode });
+ *
+ * MySql的连接方式                        类型      连接名        IP           数据库     用户名        密码
+ * multi_database_space::Control control({ "QMYSQL", "TestDB", "localhost", "JasonDB", "root", "YourPassword" });
+ *
+ * SqlServer的连接方式                    类型      连接名         数据库
+ * multi_database_space::Control control({ "QODBC", "TestDB", "Driver={SQL SERVER};server=iZ23kn6vmgkZ\\TEST;database=test;uid=sa;pwd=YourPassword;" });
+ *
+ * 注：关于附加参数
+ * 使用默认值即可。
+ * maxOpenTime: 打开数据库最大时间, 默认打开数据库起60秒内未进行查询，就自动断开。避免打开数据库后长时间空置，造成资源浪费和意外断开
+ * QueryMode：查询模式，默认为QueryAutoMode，推荐大型数据库如MySql使用QueryMultiMode，例如Sqlite的轻量级数据库使用QuerySingleMode，详见enum QueryMode
+ * minWaitTime: 兼容旧配置的最小查询间隔，默认不限制。Sqlite等数据库繁忙时，Query::exec()会自动退避并重试，也可通过rateLimit限制语句速率
+ */
+
+namespace
 {
-    QCoreApplication a(argc, argv);
 
-    /*
-     * 注：关于附加参数
-     * 使用默认值即可。
-     * maxOpenTime: 打开数据库最大时间, 默认打开数据库起60秒内未进行查询，就自动断开。避免打开数据库后长时间空置，造成资源浪费和意外断开
-     * QueryMode：查询模式，默认为QueryAutoMode，推荐大型数据库如MySql使用QueryMultiMode，例如Sqlite的轻量级数据库使用QuerySingleMode，详见enum QueryMode
-     * minWaitTime: 查询数据库最小等待时间(最小查询间隔)，比如Sqlite数据库，密集查询时可能出错，可控制最小查询间隔，如10ms
-     */
+enum Operation
+{
+    SelectOperation,
+    InsertOperation,
+    UpdateOperation,
+    DeleteOperation,
+    ScanOperation,
+    OperationCount
+};
+
+const char *const operationName[OperationCount] = { "select", "insert", "update", "delete", "scan" };
 
-    // Sqlite的连接方式                      类型        连接名      Sqlite文件路径   单次打开数据库最大时间        查询模式                最小等待时间
-    multi_database_space::Control control({ "QSQLITE", "TestDB", "./test.db" }, { 60 * 1000, multi_database_space::QuerySingleMode, 10});
+struct BenchmarkSettings
+{
+    QString driver;
+    QString database;
+    QString host;
+    QString user;
+    QString password;
+
+    QString mode;
+    QueryMode queryMode;
+    int threads;
+    double readRatio;
+    int rows;
+    quint32 seed;
+    int duration; // 秒
+    bool typed;
+    bool groupCommit;
+    int resultCache; // 字节
+    int scanThreads;
+    QueryPriority scanPriority;
+    bool bulkLoad;
+    int slowQuery; // 毫秒，小于0时不开启
+    QString slowQueryLog;
+    int checkout; // 每个线程的取得次数，为0时不测量
+    bool json;
+};
+
+struct OperationStats
+{
+    LatencyHistogram latency;
+    QAtomicInteger<qint64> errorCount;
+    QAtomicInteger<qint64> rowCount; // select取出的行数
+};
 
-    // MySql的连接方式                      类型      连接名        IP           数据库     用户名        密码
-    // JasonQt_Database::Control control({ "QMYSQL", "TestDB", "localhost", "JasonDB", "root", "YourPassword" });
+typedef std::mt19937 Random;
 
+QueryMode queryModeFromName(const QString &name)
+{
+    if(name == "single") { return QuerySingleMode; }
+    if(name == "multi") { return QueryMultiMode; }
+    if(name == "pool") { return QueryPoolMode; }
+    if(name == "wal") { return QueryWalMode; }
+    return QueryAutoMode;
+}
+
+QString randomText(Random &random)
+{
+    std::uniform_int_distribution<int> letter(0, 25);
+
+    QString buf;
+    for(int now = 0; now < 50; now++)
+    {
+        buf.append(QChar('a' + letter(random)));
+    }
+    return buf;
+}
 
-    // SqlServer的连接方式                   类型      连接名         数据库                                         数据库名     用户名         密码
-    // JasonQt_Database::Control control({ "QODBC", "TestDB", "Driver={SQL SERVER};server=iZ23kn6vmgkZ\\TEST;database=test;uid=sa;pwd=YourPassword;" });
+bool exec(Control &control, const QString &sql, const QVariantList &binds, const bool &groupCommit)
+{
+    if(groupCommit) {
+        return control.enqueue(sql, binds).result().ok;
+    }
 
+    auto query(control.prepared(sql));
 
-    control.query()->exec("create table Test1( \
-                              data int not NULL \
-                          );");
+    for(const auto &value: binds)
+    {
+        query->addBindValue(value);
+    }
 
-    control.query()->exec("create table Test2( \
-                              num integer primary key autoincrement,\
-                              data1 int not NULL, \
-                              data2 text not NULL \
-                          );");
+    return query.exec();
+}
 
-    auto insert = [&]()
+/*!
+ * \brief selectRows 执行select并取出所有行
+ * \param rowCount 累加取出的行数
+ */
+bool selectRows(Control &control, const bool &typed, const int &first, const int &second, qint64 &rowCount)
+{
+    if(typed)
     {
-        auto query(control.query()); // query解引用（->）后返回的是 QSqlQuery
+        const auto &&result1 = control.select<int>("select * from Test1 where data = ?", first);
+        const auto &&result2 = control.select<qint64, int, QString>("select * from Test2 where data1 = ?", second);
+        rowCount += result1.rows.size() + result2.rows.size();
+        return result1.ok && result2.ok;
+    }
 
-        query->prepare("insert into Test1 values(?)"); // 模拟插入操作
+    const auto &&result1 = control.exec("select * from Test1 where data = ?", { first });
+    const auto &&result2 = control.exec("select * from Test2 where data1 = ?", { second });
+    rowCount += result1.rows.size() + result2.rows.size();
+    return result1.ok && result2.ok;
+}
 
-        query->addBindValue(rand() % 1280);
+/*!
+ * \brief execute 执行一次操作，与原测试相同，每次操作分别作用于Test1与Test2
+ */
+bool execute(Control &control, const BenchmarkSettings &settings, const Operation &operation, Random &random, qint64 &rowCount)
+{
+    std::uniform_int_distribution<int> key(0, settings.rows - 1);
 
-        if(!query->exec())
-        {
-            qDebug() << "Error" << __LINE__;
-        }
+    switch(operation)
+    {
+    case SelectOperation: {
+        const auto &&first = key(random);
+        const auto &&second = key(random);
+        return selectRows(control, settings.typed, first, second, rowCount);
+    }
+    case InsertOperation: {
+        return exec(control, "insert into Test1 values(?)", { key(random) }, settings.groupCommit) &&
+                exec(control, "insert into Test2 values(NULL, ?, ?)", { key(random), randomText(random) }, settings.groupCommit);
+    }
+    case UpdateOperation: {
+        return exec(control, "update Test1 set data = ? where data = ?", { key(random), key(random) }, settings.groupCommit) &&
+                exec(control, "update Test2 set data1 = ?, data2 = ? where data1 = ?", { key(random), randomText(random), key(random) }, settings.groupCommit);
+    }
+    case DeleteOperation: {
+        return exec(control, "delete from Test1 where data = ?", { key(random) }, settings.groupCommit) &&
+                exec(control, "delete from Test2 where data1 = ?", { key(random) }, settings.groupCommit);
+    }
+    default: {
+        return false;
+    }
+    }
+}
 
-        query->clear();
+bool prepareDataset(Control &control, const BenchmarkSettings &settings)
+{
+    const auto &&mysql = settings.driver == "QMYSQL";
 
-        query->prepare("insert into Test2 values(NULL, ?, ?)");
+    control.query().exec("drop table if exists Test1");
+    control.query().exec("drop table if exists Test2");
 
-        query->addBindValue(rand() % 1280);
-        QString buf;
-        for(int now = 0; now < 50; now++)
-        {
-            buf.append('a' + (rand() % 26));
-        }
-        query->addBindValue(buf);
+    if(!control.query().exec("create table Test1(data int not NULL)")) {
+        return false;
+    }
+    if(!control.query().exec(mysql ?
+                             "create table Test2(num bigint not NULL AUTO_INCREMENT, data1 int not NULL, data2 text not NULL, PRIMARY KEY(num))" :
+                             "create table Test2(num integer primary key autoincrement, data1 int not NULL, data2 text not NULL)")) {
+        return false;
+    }
 
-        if(!query->exec())
-        {
-            qDebug() << "Error" << __LINE__;
-        }
-    };
-    auto delete_ = [&]()
-    {
-        auto query(control.query());
+    Random random(settings.seed);
+    std::uniform_int_distribution<int> key(0, settings.rows - 1);
 
-        query->prepare("delete from Test1 where data = ?");
+    QVariantList data, data1, data2;
+    for(int now = 0; now < settings.rows; now++)
+    {
+        data << key(random);
+        data1 << key(random);
+        data2 << randomText(random);
+    }
 
-        query->addBindValue(rand() % 1280);
+    if(settings.bulkLoad)
+    {
+        QTemporaryFile file1, file2;
+        if(!file1.open() || !file2.open()) {
+            return false;
+        }
 
-        if(!query->exec())
+        for(int now = 0; now < settings.rows; now++)
         {
-            qDebug() << "Error" << __LINE__;
+            file1.write(QByteArray::number(data[now].toInt()) + '\n');
+            file2.write(QByteArray::number(data1[now].toInt()) + ',' + data2[now].toString().toUtf8() + '\n');
         }
+        file1.flush();
+        file2.flush();
 
-        query->clear();
+        return control.bulkLoad(file1.fileName(), BulkLoadSettings("Test1", { "data" })).ok &&
+                control.bulkLoad(file2.fileName(), BulkLoadSettings("Test2", { "data1", "data2" })).ok;
+    }
 
-        query->prepare("delete from Test2 where data1 = ?");
+    return control.execBatch("insert into Test1 values(?)", { data }).ok &&
+            control.execBatch("insert into Test2(data1, data2) values(?, ?)", { data1, data2 }).ok;
+}
 
-        query->addBindValue(rand() % 1280);
+void runWorker(Control &control, const BenchmarkSettings &settings, const int &index, const QElapsedTimer &clock, OperationStats *stats)
+{
+    // 每个线程使用独立的随机数发生器，序列只由种子和线程序号决定
+    Random random(settings.seed + quint32(index) + 1);
+    std::uniform_real_distribution<double> mix(0, 1);
+    std::uniform_int_distribution<int> write(InsertOperation, DeleteOperation);
 
-        if(!query->exec())
-        {
-            qDebug() << "Error" << __LINE__;
-        }
-    };
-    auto update = [&]()
+    const qint64 end = qint64(settings.duration) * 1000;
+    while(clock.elapsed() < end)
     {
-        auto query(control.query());
+        const auto &&operation = (mix(random) < settings.readRatio) ? SelectOperation : Operation(write(random));
 
-        query->prepare("update Test1 set data = ? where data = ?");
+        qint64 rowCount = 0;
+        QElapsedTimer timer;
+        timer.start();
+        const auto &&ok = execute(control, settings, operation, random, rowCount);
+        stats[operation].latency.record(timer.nsecsElapsed() / 1000);
 
-        query->addBindValue(rand() % 1280);
-        query->addBindValue(rand() % 1280);
-
-        if(!query->exec())
-        {
-            qDebug() << "Error" << __LINE__;
+        if(!ok) {
+            stats[operation].errorCount.fetchAndAddRelaxed(1);
         }
+        stats[operation].rowCount.fetchAndAddRelaxed(rowCount);
+    }
+}
 
-        query->clear();
+void runScanWorker(Control &control, const BenchmarkSettings &settings, const QElapsedTimer &clock, OperationStats *stats)
+{
+    const qint64 end = qint64(settings.duration) * 1000;
+    while(clock.elapsed() < end)
+    {
+        QElapsedTimer timer;
+        timer.start();
 
-        query->prepare("update Test2 set data1 = ?, data2 = ? where data1 = ?");
+        auto cursor(control.cursor("select * from Test2", QVariantList(), -1, settings.scanPriority));
+        for(auto it = cursor.begin(); it != cursor.end(); ++it) { }
+        stats[ScanOperation].latency.record(timer.nsecsElapsed() / 1000);
 
-        query->addBindValue(rand() % 1280 + 1);
-        QString buf;
-        for(int now = 0; now < 50; now++)
-        {
-            buf.append('a' + (rand() % 26));
+        if(!cursor.isValid() || cursor.lastError().isValid()) {
+            stats[ScanOperation].errorCount.fetchAndAddRelaxed(1);
         }
-        query->addBindValue(buf);
-        query->addBindValue(rand() % 1280 + 1);
+        stats[ScanOperation].rowCount.fetchAndAddRelaxed(cursor.rowCount());
+    }
+}
 
-        if(!query->exec())
-        {
-            qDebug() << "Error" << __LINE__;
-        }
+QJsonObject report(const BenchmarkSettings &settings, const qint64 &prepareElapsed, const qint64 &elapsed, OperationStats *stats, Control &control)
+{
+    const auto &&seconds = qMax<double>(elapsed, 1) / 1000.0;
+
+    QJsonObject operations;
+    qint64 totalCount = 0;
+    for(int now = 0; now < OperationCount; now++)
+    {
+        const auto &&snapshot = stats[now].latency.snapshot();
+        totalCount += snapshot.count;
+
+        operations[operationName[now]] = QJsonObject({
+                                                         { "count", snapshot.count },
+                                                         { "errorCount", stats[now].errorCount.load() },
+                                                         { "rowCount", stats[now].rowCount.load() },
+                                                         { "throughput", snapshot.count / seconds },
+                                                         { "latency", snapshot.toJson() }
+                                                     });
+    }
+
+    return QJsonObject({
+                           { "config", QJsonObject({
+                                 { "driver", settings.driver },
+                                 { "database", settings.database },
+                                 { "mode", settings.mode },
+                                 { "threads", settings.threads },
+                                 { "readRatio", settings.readRatio },
+                                 { "rows", settings.rows },
+                                 { "seed", qint64(settings.seed) },
+                                 { "duration", settings.duration },
+                                 { "typed", settings.typed },
+                                 { "groupCommit", settings.groupCommit },
+                                 { "resultCache", settings.resultCache },
+                                 { "scanThreads", settings.scanThreads },
+                                 { "scanPriority", (settings.scanPriority == BackgroundPriority) ? "background" : "interactive" },
+                                 { "bulkLoad", settings.bulkLoad },
+                                 { "slowQuery", settings.slowQuery }
+                             }) },
+                           { "prepareElapsed", prepareElapsed },
+                           { "elapsed", elapsed },
+                           { "count", totalCount },
+                           { "throughput", totalCount / seconds },
+                           { "operations", operations },
+                           { "metrics", control.metrics().toJson() }
+                       });
+}
+
+/*!
+ * \brief checkoutCost 每个线程执行count次checkout，返回每次的平均耗时(纳秒)
+ */
+template<typename Function>
+double checkoutCost(const int &threads, const int &count, const Function &checkout)
+{
+    QThreadPool workers;
+    workers.setMaxThreadCount(threads);
+
+    QElapsedTimer timer;
+    timer.start();
+    for(int now = 0; now < threads; now++)
+    {
+        QtConcurrent::run(&workers, [&]() {
+            for(int index = 0; index < count; index++)
+            {
+                checkout();
+            }
+        });
+    }
+    workers.waitForDone();
+
+    return double(timer.nsecsElapsed()) / (qint64(threads) * count);
+}
+
+QJsonObject runCheckout(const DatabaseSettings &databaseSettings, ConnectSettings connectSettings, const BenchmarkSettings &settings)
+{
+    // 重构前Query复制连接点的QSharedPointer<QMutex>并占用递归锁，析构时解锁
+    QSharedPointer<QMutex> mutex(new QMutex(QMutex::Recursive));
+    const auto recursiveMutex = [&mutex]() {
+        const auto held = mutex;
+        held->lock();
+        held->unlock();
     };
-    auto select = [&]()
+
+    // 使用默认的统计设置，无竞争的占用不记录锁等待
+    connectSettings.setMaxOpenTime(0);
+    ConnectNode node(databaseSettings, connectSettings);
+    const auto lease = [&node]() {
+        auto held = node.lease();
+        held.release();
+    };
+
+    QList<int> threadCounts = { 1 };
+    if(settings.threads > 1) {
+        threadCounts.append(settings.threads);
+    }
+
+    QJsonArray runs;
+    for(const auto &threads: threadCounts)
     {
-        auto query(control.query());
+        const auto &&before = checkoutCost(threads, settings.checkout, recursiveMutex);
+        const auto &&after = checkoutCost(threads, settings.checkout, lease);
+
+        runs.append(QJsonObject({
+                                    { "threads", threads },
+                                    { "iterations", settings.checkout },
+                                    { "recursiveMutex", before },
+                                    { "lease", after },
+                                    { "speedup", after ? (before / after) : 0 }
+                                }));
+    }
 
-        query->prepare("select * from Test1 where data = ?");
+    return QJsonObject({ { "checkout", runs } });
+}
 
-        query->addBindValue(rand() % 1280);
+QString checkoutText(const QJsonObject &result)
+{
+    QString text;
+    for(const auto &&value: result["checkout"].toArray())
+    {
+        const auto &&run = value.toObject();
+        text += QString("checkout threads=%1 iterations=%2 recursiveMutex=%3ns lease=%4ns speedup=%5\n")
+                .arg(run["threads"].toInt()).arg(run["iterations"].toInt())
+                .arg(run["recursiveMutex"].toDouble(), 0, 'f', 1).arg(run["lease"].toDouble(), 0, 'f', 1)
+                .arg(run["speedup"].toDouble(), 0, 'f', 2);
+    }
+    return text;
+}
 
-        if(!query->exec())
-        {
-            qDebug() << "Error" << __LINE__;
-        }
+QString reportText(const QJsonObject &result)
+{
+    QString text;
+    const auto &&config = result["config"].toObject();
+    text += QString("mode=%1 threads=%2 readRatio=%3 rows=%4 seed=%5 duration=%6s typed=%7 groupCommit=%8\n")
+            .arg(config["mode"].toString()).arg(config["threads"].toInt()).arg(config["readRatio"].toDouble())
+            .arg(config["rows"].toInt()).arg(config["seed"].toInt()).arg(config["duration"].toInt())
+            .arg(config["typed"].toBool() ? "true" : "false").arg(config["groupCommit"].toBool() ? "true" : "false");
+    text += QString("prepareElapsed=%1ms bulkLoad=%2\n").arg(qint64(result["prepareElapsed"].toDouble())).arg(config["bulkLoad"].toBool() ? "true" : "false");
+    text += QString("count=%1 throughput=%2/s\n").arg(qint64(result["count"].toDouble())).arg(result["throughput"].toDouble(), 0, 'f', 1);
+
+    const auto &&operations = result["operations"].toObject();
+    for(int now = 0; now < OperationCount; now++)
+    {
+        const auto &&operation = operations[operationName[now]].toObject();
+        const auto &&latency = operation["latency"].toObject();
+        text += QString("%1 count=%2 errors=%3 rows=%4 throughput=%5/s p50=%6us p99=%7us p999=%8us max=%9us\n")
+                .arg(QString(operationName[now]), -6)
+                .arg(qint64(operation["count"].toDouble())).arg(qint64(operation["errorCount"].toDouble()))
+                .arg(qint64(operation["rowCount"].toDouble()))
+                .arg(operation["throughput"].toDouble(), 0, 'f', 1)
+                .arg(qint64(latency["p50"].toDouble())).arg(qint64(latency["p99"].toDouble()))
+                .arg(qint64(latency["p999"].toDouble())).arg(qint64(latency["max"].toDouble()));
+    }
+    return text;
+}
 
-        query->clear();
+}
 
-        query->prepare("select * from Test2 where data1 = ?");
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
 
-        query->addBindValue(rand() % 1280);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("multi_database_space benchmark");
+    parser.addHelpOption();
+    parser.addOptions({
+                          { "driver", "Qt sql driver.", "driver", "QSQLITE" },
+                          { "database", "Sqlite file path, or database name in host mode.", "database", "./test.db" },
+                          { "host", "Host name, enables host mode.", "host" },
+                          { "user", "User name in host mode.", "user" },
+                          { "password", "Password in host mode.", "password" },
+                          { "mode", "Query mode: auto, single, multi, pool, wal.", "mode", "single" },
+                          { "threads", "Worker thread count.", "threads", "3" },
+                          { "read-ratio", "Ratio of select operations, the rest is split evenly between insert, update and delete.", "ratio", "0.85" },
+                          { "rows", "Rows preloaded into each table, also the key range.", "rows", "1280" },
+                          { "seed", "Random seed.", "seed", "1" },
+                          { "duration", "Duration in seconds.", "seconds", "10" },
+                          { "typed", "Fetch select rows with Control::select<Ts...>() instead of QSqlRecord." },
+                          { "group-commit", "Send insert, update and delete through Control::enqueue() and wait for the commit." },
+                          { "result-cache", "Result cache budget in bytes, 0 disables it.", "bytes", "0" },
+                          { "scan-threads", "Extra threads repeatedly scanning Test2 with a cursor.", "threads", "0" },
+                          { "scan-priority", "Priority of the scan threads: interactive, background.", "priority", "background" },
+                          { "bulk-load", "Load the dataset from CSV files with Control::bulkLoad() instead of execBatch." },
+                          { "slow-query", "Slow query threshold in milliseconds, negative disables the slow query log.", "ms", "-1" },
+                          { "slow-query-log", "Slow query log file, empty keeps the statistics in memory only.", "path" },
+                          { "checkout", "Only measure connection checkout and return, iterations per thread.", "iterations", "0" },
+                          { "format", "Output format: json, text.", "format", "json" }
+                      });
+    parser.process(a);
+
+    BenchmarkSettings settings;
+    settings.driver = parser.value("driver");
+    settings.database = parser.value("database");
+    settings.host = parser.value("host");
+    settings.user = parser.value("user");
+    settings.password = parser.value("password");
+    settings.mode = parser.value("mode");
+    settings.queryMode = queryModeFromName(settings.mode);
+    settings.threads = qMax(1, parser.value("threads").toInt());
+    settings.readRatio = qBound(0.0, parser.value("read-ratio").toDouble(), 1.0);
+    settings.rows = qMax(1, parser.value("rows").toInt());
+    settings.seed = parser.value("seed").toUInt();
+    settings.duration = qMax(1, parser.value("duration").toInt());
+    settings.typed = parser.isSet("typed");
+    settings.groupCommit = parser.isSet("group-commit");
+    settings.resultCache = qMax(0, parser.value("result-cache").toInt());
+    settings.scanThreads = qMax(0, parser.value("scan-threads").toInt());
+    settings.scanPriority = (parser.value("scan-priority") == "interactive") ? InteractivePriority : BackgroundPriority;
+    settings.bulkLoad = parser.isSet("bulk-load");
+    settings.slowQuery = parser.value("slow-query").toInt();
+    settings.slowQueryLog = parser.value("slow-query-log");
+    settings.checkout = qMax(0, parser.value("checkout").toInt());
+    settings.json = parser.value("format") != "text";
+
+    ConnectSettings connectSettings(60 * 1000, settings.queryMode);
+    connectSettings.setPoolMaxSize(settings.threads);
+    connectSettings.setWalReaderCount(settings.threads);
+    connectSettings.setResultCacheSize(settings.resultCache);
+    connectSettings.setSlowQueryThreshold(settings.slowQuery);
+    connectSettings.setSlowQueryLogPath(settings.slowQueryLog);
+
+    const auto &&databaseSettings = settings.host.isEmpty() ?
+                DatabaseSettings(settings.driver, "Benchmark", settings.database) :
+                DatabaseSettings(settings.driver, "Benchmark", settings.host, settings.database, settings.user, settings.password);
+
+    if(settings.checkout > 0)
+    {
+        const auto &&result = runCheckout(databaseSettings, connectSettings, settings);
 
-        if(!query->exec())
-        {
-            qDebug() << "Error" << __LINE__;
+        QTextStream out(stdout);
+        if(settings.json) {
+            out << QJsonDocument(result).toJson();
+        } else {
+            out << checkoutText(result);
         }
-    };
+        return 0;
+    }
 
-    volatile int count = 0, last = 0;
+    Control control(databaseSettings, connectSettings);
 
-    QTime time;
-    time.start();
+    QElapsedTimer prepareTimer;
+    prepareTimer.start();
+    if(!prepareDataset(control, settings))
+    {
+        qCritical() << "prepare dataset failed";
+        return 1;
+    }
+    const auto &&prepareElapsed = prepareTimer.elapsed();
 
-    QThreadPool::globalInstance()->setMaxThreadCount(10);
+    OperationStats stats[OperationCount];
 
-    for(int now = 0; now < 3; now++) // 开启3个线程测试
+    QThreadPool workers;
+    workers.setMaxThreadCount(settings.threads + settings.scanThreads);
+
+    QElapsedTimer clock;
+    clock.start();
+
+    for(int now = 0; now < settings.threads; now++)
     {
-        QtConcurrent::run([&]()
-        {
-            while(true)
-            {
-                count++;
-                if(!(count % 1000))
-                {
-                    const auto &&now = time.elapsed();
-                    qDebug() << now - last; // 打印每完成1000语句的时间
-                    last = now;
-                }
-
-                switch(rand() % 20)
-                {
-                case 0:  { insert(); break; }
-                case 1:  { delete_(); break; }
-                case 2:  { update(); break; }
-                default: { select(); break; }
-                }
-            }
-            QThread::msleep(10);
-        });
+        QtConcurrent::run(&workers, [&, now]() { runWorker(control, settings, now, clock, stats); });
     }
+    for(int now = 0; now < settings.scanThreads; now++)
+    {
+        QtConcurrent::run(&workers, [&]() { runScanWorker(control, settings, clock, stats); });
+    }
+    workers.waitForDone();
+
+    const auto &&result = report(settings, prepareElapsed, clock.elapsed(), stats, control);
 
-    //    QTimer::singleShot(10000, [&](){
-    //      control.destroyAllConnection();
-    //    });
+    QTextStream out(stdout);
+    if(settings.json) {
+        out << QJsonDocument(result).toJson();
+    } else {
+        out << reportText(result);
+    }
 
-    return a.exec();
+    return 0;
 }
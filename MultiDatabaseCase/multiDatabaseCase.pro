@@ -14,6 +14,15 @@ TEMPLATE = app
 CONFIG += c++11
 CONFIG += console
 
+# Sources contain Chinese comments; MSVC reads files without a UTF-8 BOM (e.g. main.cpp) in the local code page.
+msvc: QMAKE_CXXFLAGS += /utf-8
+
+# Interrupt running Sqlite statements with sqlite3_interrupt() when a Query deadline expires or is cancelled.
+# Qt must be built with -system-sqlite so that QSQLITE and this library share the same sqlite3.
+# Without it, deadlines and cancel tokens on QSQLITE only apply before a statement starts, and a warning is logged once.
+#DEFINES += MULTIDATABASE_SQLITE_INTERRUPT
+#LIBS += -lsqlite3
+
 SOURCES += main.cpp \
     multiDatabase/multiDatabase.cpp
 
@@ -26,6 +26,7 @@ class NodePrivate
     QSet<NodePrivatePtr> childs;
     PorpertyMap m_porpertyMap;
     bool m_isVaild;
+    mutable int m_depth = -1; // 缓存的深度，-1表示未计算
 
 private:
     explicit NodePrivate(const QString &typeName, const NodePrivatePtr &parent) :
@@ -52,7 +53,28 @@ private:
     { m_isVaild  = false; }
 
     inline setParent(const NodePrivatePtr &parent)
-    { m_parent = parent; }
+    { m_parent = parent; resetDepth(); }
+
+    /*!
+     * \brief depth 由父节点的深度递推并缓存，每个节点只计算一次
+     */
+    int depth() const
+    {
+        if (m_depth < 0)
+            m_depth = m_parent ? m_parent->depth() + 1 : 0;
+        return m_depth;
+    }
+
+    /*!
+     * \brief resetDepth 父节点改变后，自身及子孙节点的深度缓存失效
+     */
+    void resetDepth()
+    {
+        m_depth = -1;
+        foreach (const auto &child, childs) {
+            child->resetDepth();
+        }
+    }
 
     void insetChild(const NodePrivatePtr &child)
     { childs.insert(child); }
@@ -100,6 +122,26 @@ public:
         return m_p->m_typeName;
     }
 
+    inline bool isValid() const
+    {
+        return m_p && m_p->isVaild();
+    }
+
+    inline const PorpertyMap &propertyMap() const
+    {
+        Q_ASSERT(m_p);
+        return m_p->m_porpertyMap;
+    }
+
+    /*!
+     * \brief depth 节点深度，根节点为0，缓存于NodePrivate
+     */
+    inline int depth() const
+    {
+        Q_ASSERT(m_p);
+        return m_p->depth();
+    }
+
     inline void setProperty(const QString &propertyName, const QVariant &variant) const
     {
         Q_ASSERT(m_p);
@@ -1,4 +1,5 @@
 #include "sqlTree.h"
+#include <QHash>
 #include <QSqlQuery>
 
 using namespace sql_tree_space;
@@ -34,6 +35,20 @@ static bool match(const NodeFeature &nodeFeature, const SqlTableFeature &sqlTabl
     return false;
 }
 
+bool SqlInterface::uniqueInsertRows(const QString tableName, const QStringList &filedList, const QList<QVariantList> &columns)
+{
+    const int rowCount = columns.isEmpty() ? 0 : columns.first().size();
+    for (int row = 0; row < rowCount; ++row) {
+        QMap<QString, QVariant> valMap;
+        for (int index = 0; index < filedList.size(); ++index) {
+            valMap.insert(filedList.at(index), columns.at(index).at(row));
+        }
+        prepareUniqueInsert(tableName, valMap);
+    }
+    exeBath();
+    return true;
+}
+
 QList<NodeFeature>::const_iterator NodeFeature::findNodeFeature(const QList<NodeFeature> &features, const QString &typeName)
 {
     auto constIterator = features.constBegin();
@@ -204,16 +219,119 @@ void SqlTree::saveNodes(const QList<Node> &nodes) const
     if (nodes.isEmpty())
         return;
 
-    foreach (const auto &node, nodes) {
+    // 节点的类型名与数据库表名有对应关系，按类型名分组，组内按深度分层以先写父节点，
+    // 同一层再按属性集合(propertyNameList()已排序)分组，只写入节点拥有的属性
+    typedef QMap<QStringList, QList<const Node *>> FiledGroupMap;
+    QHash<QString, QMap<int, FiledGroupMap>> groupMap;
+    for (const auto &node : nodes) {
         if (node.isValid()) {
-            // 节点的类型名与数据库表名有对应关系
-            Q_ASSERT(m_sqlInterface.hasTable(node.typeName()));
-            QString tableName = node.typeName();
-            QMap valMap = node.propertyMap();
-            m_sqlInterface->prepareUniqueInsert(tableName, valMap);
+            groupMap[node.typeName()][node.depth()][node.propertyNameList()] << &node;
+        }
+    }
+
+    if (groupMap.isEmpty())
+        return;
+
+    if (!m_sqlInterface->transaction()) {
+        qWarning() << "SqlTree::saveNodes: begin transaction failed, nothing saved";
+        return;
+    }
+
+    foreach (const QString &tableName, saveOrder(groupMap.keys())) {
+        Q_ASSERT(m_sqlInterface->hasTable(tableName));
+
+        foreach (const auto &level, groupMap.value(tableName)) {
+            for (auto it = level.constBegin(); it != level.constEnd(); ++it) {
+                if (!saveRows(tableName, it.key(), it.value())) {
+                    qWarning() << "SqlTree::saveNodes: save failed," << tableName;
+                    m_sqlInterface->rollback();
+                    return;
+                }
+            }
         }
     }
-    m_sqlInterface->exeBath();
+
+    if (!m_sqlInterface->commit()) {
+        qWarning() << "SqlTree::saveNodes: commit failed";
+        m_sqlInterface->rollback();
+    }
+}
+
+bool SqlTree::saveRows(const QString &tableName, const QStringList &filedList, const QList<const Node *> &rows) const
+{
+    // 按列绑定，每块一条多行语句，每行绑定filedList.size()个参数
+    const int chunkSize = qBound(1, m_sqlInterface->parameterLimit() / qMax(1, filedList.size()), m_saveChunkSize);
+    for (int offset = 0; offset < rows.size(); offset += chunkSize) {
+        const int length = qMin(chunkSize, rows.size() - offset);
+
+        QList<QVariantList> columns;
+        columns.reserve(filedList.size());
+        foreach (const QString &filed, filedList) {
+            QVariantList column;
+            column.reserve(length);
+            for (int row = offset; row < offset + length; ++row) {
+                column << rows.at(row)->propertyMap().value(filed);
+            }
+            columns << column;
+        }
+
+        if (!m_sqlInterface->uniqueInsertRows(tableName, filedList, columns))
+            return false;
+    }
+    return true;
+}
+
+QStringList SqlTree::saveOrder(const QStringList &typeNames) const
+{
+    // 按节点特征中的父子类型关系拓扑排序，父节点类型在前
+    auto nodeFeatureList = tree.nodeFeatureList();
+
+    QMap<QString, int> parentCountMap;
+    foreach (const QString &typeName, typeNames) {
+        parentCountMap.insert(typeName, 0);
+    }
+    foreach (const auto &nodeFt, nodeFeatureList) {
+        if (!parentCountMap.contains(nodeFt.typeName))
+            continue;
+        foreach (const QString &childTypeName, nodeFt.childTypeNameSet) {
+            // 自身嵌套的类型由组内按深度排序保证顺序
+            if (childTypeName != nodeFt.typeName && parentCountMap.contains(childTypeName))
+                ++parentCountMap[childTypeName];
+        }
+    }
+
+    QStringList readyList;
+    for (auto it = parentCountMap.constBegin(); it != parentCountMap.constEnd(); ++it) {
+        if (0 == it.value())
+            readyList << it.key();
+    }
+
+    QStringList order;
+    while (!readyList.isEmpty()) {
+        const QString typeName = readyList.takeFirst();
+        order << typeName;
+
+        auto findIt = NodeFeature::findNodeFeature(nodeFeatureList, typeName);
+        if (findIt == nodeFeatureList.constEnd())
+            continue;
+        foreach (const QString &childTypeName, findIt->childTypeNameSet) {
+            if (childTypeName != typeName && parentCountMap.contains(childTypeName)
+                    && 0 == --parentCountMap[childTypeName]) {
+                readyList << childTypeName;
+            }
+        }
+    }
+
+    // 类型间存在环时无法满足外键顺序，其余类型按名称追加
+    if (order.size() < parentCountMap.size()) {
+        qWarning() << "SqlTree::saveOrder: cyclic node types, foreign key order not guaranteed";
+        foreach (const QString &typeName, parentCountMap.keys()) {
+            if (!order.contains(typeName))
+                order << typeName;
+        }
+    }
+
+    return order;
 }
 
 void SqlTree::destoryTakenNodes()
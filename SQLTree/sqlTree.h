@@ -24,6 +24,27 @@ class SqlInterface
     virtual void prepareUniqueInsert(const QString tableName, const QMap<QString, QVariant> &valMap) = 0;
     virtual void prepareUpdate(const QString tableName, const QMap<QString, QVariant> &valMap) = 0;
     virtual void exeBath() = 0;
+    /*!
+     * \brief uniqueInsertRows 以一条多行语句唯一插入(主键已存在时更新)多行
+     * 默认逐行调用prepareUniqueInsert()后exeBath()，后端应重写为一条多行语句
+     * \param filedList 字段名列表
+     * \param columns 按列绑定的值，每个字段一列，各列行数相同
+     */
+    virtual bool uniqueInsertRows(const QString tableName, const QStringList &filedList, const QList<QVariantList> &columns);
+    /*!
+     * \brief parameterLimit 单条语句可绑定参数数量的上限，如Sqlite为999，SqlServer为2100，默认999
+     */
+    virtual int parameterLimit() const
+    { return 999; }
+    /*!
+     * \brief transaction 默认不支持事务：transaction()、commit()直接返回true，保存不具原子性，rollback()返回false
+     */
+    virtual bool transaction()
+    { return true; }
+    virtual bool commit()
+    { return true; }
+    virtual bool rollback()
+    { return false; }
 };
 
 struct NodePorperty
@@ -110,6 +131,7 @@ private:
     Tree tree;
     SqlSynchro synchro;
     QSet<Node> takenNodeSet;
+    int m_saveChunkSize = 1000; // 每条多行语句行数的上限
 
 public:
     explicit SqlTree(QSharedPointer<SqlInterface> sqlInterface);
@@ -128,13 +150,32 @@ public:
     void saveAll(SaveModel model = expand);
     bool load();
 
+    inline int saveChunkSize() const
+    { return m_saveChunkSize; }
+    /*!
+     * \brief setSaveChunkSize 设置保存时每条多行语句行数的上限，
+     * 实际行数另受SqlInterface::parameterLimit()限制，不超过parameterLimit() / 字段数
+     */
+    inline void setSaveChunkSize(int saveChunkSize)
+    { m_saveChunkSize = qMax(1, saveChunkSize); }
+
     Node createNode(const QString &uid, const QString &typeName);
     Node takeNode(const QString &uid);
 
 private:
     void synchronizeSqlFeature(SaveModel model) const;
     bool canSave() const;
+    /*!
+     * \brief saveNodes 在一个事务中保存节点，按类型名(表名)分组，父节点类型的表先于子节点类型的表写入，
+     * 同一表中按深度先写父节点，同一深度再按节点拥有的属性集合分组，每组按列绑定并分块以多行语句唯一插入，失败时回滚
+     * 节点未设置的属性不写入，不会以NULL覆盖数据库中已有的值
+     */
     void saveNodes(const QList<Node> &nodes) const;
+    /*!
+     * \brief saveRows 分块写入属性集合均为filedList的一组节点
+     */
+    bool saveRows(const QString &tableName, const QStringList &filedList, const QList<const Node *> &rows) const;
+    QStringList saveOrder(const QStringList &typeNames) const;
     void destoryTakenNodes();
 
 private: